@@ -0,0 +1,308 @@
+#pragma once
+
+#include "constants.hpp"
+#include "database_manager.hpp"
+#include "errors.hpp"
+#include "logger.hpp"
+#include "macros.hpp"
+#include "partitions.hpp"
+#include "sql.hpp"
+
+#include <SQLiteCpp/Backup.h>
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Exception.h>
+#include <SQLiteCpp/Statement.h>
+#include <algorithm>
+#include <chrono>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <sqlite3.h>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Takes consistent backups of the database partitions while the backend keeps writing
+///
+/// Scheduled backups use the SQLite online backup API. They are driven from the event loop
+/// with tick(), which copies at most BACKUP_STEP_PAGES pages per call, so the writer never
+/// waits longer than one short step. The active partition is backed up through the writer
+/// connection, so writes made during the backup are carried over to it. When that connection
+/// is closed, e.g. at the turn of the year, the backup is aborted and retried later.
+class BackupManager final
+{
+  public:
+    explicit BackupManager(std::filesystem::path backup_dir) : backup_dir_(std::move(backup_dir)) {}
+
+    /// Performs one step of the running backup, or starts a new one when it is due
+    [[nodiscard]]
+    auto tick(DatabaseManager& db_manager) -> std::expected<void, Error>
+    {
+        if (!job_) {
+            if (is_due()) {
+                TRY(start(db_manager));
+            }
+            return {};
+        }
+
+        if (const auto result = step(db_manager); !result) {
+            abort();
+            return std::unexpected(result.error());
+        }
+
+        return {};
+    }
+
+    /// Aborts a backup reading through the writer connection, called before that connection is closed
+    auto release_connection() -> void
+    {
+        if (!job_ || !job_->backup || job_->source) {
+            return;
+        }
+
+        common::Logger::instance().warn("Aborting backup, the partition {} is being closed",
+                                        job_->source_file.string());
+        abort();
+        next_check_ = {};
+    }
+
+    /// Writes a compacted snapshot of every partition into the given directory with VACUUM INTO
+    ///
+    /// VACUUM INTO only reads the source, so this is safe while a backend is writing.
+    [[nodiscard]]
+    static auto snapshot(const std::filesystem::path& db_dir, const std::filesystem::path& target_dir)
+      -> std::expected<std::size_t, Error>
+    {
+        auto& logger = common::Logger::instance();
+        const auto partitions = common::partitions(db_dir);
+
+        try {
+            std::filesystem::create_directories(target_dir);
+
+            for (const auto& partition : partitions) {
+                const auto target = target_dir / partition.filename();
+                logger.info("Writing snapshot of {} to {}", partition.string(), target.string());
+
+                SQLite::Database source(partition.string(), static_cast<unsigned int>(SQLite::OPEN_READONLY));
+                SQLite::Statement vacuum(source, common::VACUUM_INTO_SQL);
+                vacuum.bind(1, target.string());
+                vacuum.exec();
+            }
+        }
+        catch (const SQLite::Exception& e) {
+            return std::unexpected(make_database_error(std::format("Failed to write snapshot: {}", e.what())));
+        }
+        catch (const std::filesystem::filesystem_error& e) {
+            return std::unexpected(make_system_error(std::format("Filesystem error: {}", e.what())));
+        }
+
+        return partitions.size();
+    }
+
+    /// Returns the directory name of a new backup taken now
+    [[nodiscard]]
+    static auto timestamp_name() -> std::string
+    {
+        const auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+        return std::format("{:%Y%m%dT%H%M%S}", now);
+    }
+
+  private:
+    /// Prefix of backups that are still being written
+    static constexpr std::string_view IN_PROGRESS_PREFIX = ".in-progress-";
+
+    /// A running online backup
+    struct Job
+    {
+        std::filesystem::path directory;
+        std::filesystem::path final_directory;
+        std::vector<std::filesystem::path> pending;
+
+        std::filesystem::path source_file;
+        std::unique_ptr<SQLite::Database> source; ///< Only set for sealed partitions
+        std::unique_ptr<SQLite::Database> destination;
+        std::unique_ptr<SQLite::Backup> backup;
+    };
+
+    /// Returns whether the newest backup is older than the backup interval
+    [[nodiscard]]
+    auto is_due() -> bool
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (now < next_check_) {
+            return false;
+        }
+        next_check_ = now + std::chrono::minutes(1);
+
+        const auto backups = completed_backups();
+        if (backups.empty()) {
+            return true;
+        }
+
+        std::error_code error;
+        const auto last_write = std::filesystem::last_write_time(backups.back(), error);
+        return error || std::filesystem::file_time_type::clock::now() - last_write
+                          >= std::chrono::hours(BACKUP_INTERVAL_HOURS);
+    }
+
+    /// Starts a backup of all partitions
+    [[nodiscard]]
+    auto start(const DatabaseManager& db_manager) -> std::expected<void, Error>
+    {
+        const auto name = timestamp_name();
+
+        Job job{
+          .directory = backup_dir_ / std::format("{}{}", IN_PROGRESS_PREFIX, name),
+          .final_directory = backup_dir_ / name,
+          .pending = common::partitions(db_manager.directory()),
+          .source_file = {},
+          .source = nullptr,
+          .destination = nullptr,
+          .backup = nullptr,
+        };
+
+        try {
+            remove_stale_backups();
+            std::filesystem::create_directories(job.directory);
+        }
+        catch (const std::filesystem::filesystem_error& e) {
+            return std::unexpected(make_system_error(std::format("Failed to create backup directory: {}", e.what())));
+        }
+
+        common::Logger::instance().info("Starting backup of {} partitions to {}", job.pending.size(), name);
+        job_ = std::move(job);
+        return {};
+    }
+
+    /// Copies the next pages of the current partition, or moves on to the next partition
+    [[nodiscard]]
+    auto step(DatabaseManager& db_manager) -> std::expected<void, Error>
+    {
+        try {
+            if (!job_->backup) {
+                if (job_->pending.empty()) {
+                    return finish();
+                }
+                open_next(db_manager);
+                return {};
+            }
+
+            const int result = job_->backup->executeStep(BACKUP_STEP_PAGES);
+            if (result == SQLITE_DONE) {
+                common::Logger::instance().debug("Backed up partition {}", job_->source_file.string());
+                job_->backup.reset();
+                job_->destination.reset();
+                job_->source.reset();
+            }
+            // SQLITE_BUSY and SQLITE_LOCKED are retried on the next tick
+        }
+        catch (const SQLite::Exception& e) {
+            return std::unexpected(make_database_error(std::format("Backup step failed: {}", e.what())));
+        }
+
+        return {};
+    }
+
+    /// Sets up the backup of the next pending partition
+    auto open_next(DatabaseManager& db_manager) -> void
+    {
+        job_->source_file = job_->pending.front();
+        job_->pending.erase(job_->pending.begin());
+
+        job_->destination = std::make_unique<SQLite::Database>(
+          (job_->directory / job_->source_file.filename()).string(),
+          static_cast<unsigned int>(SQLite::OPEN_READWRITE) | static_cast<unsigned int>(SQLite::OPEN_CREATE));
+
+        SQLite::Database* source = nullptr;
+        if (job_->source_file == db_manager.active_partition() && db_manager.connection() != nullptr) {
+            source = db_manager.connection();
+        } else {
+            job_->source = std::make_unique<SQLite::Database>(job_->source_file.string(),
+                                                              static_cast<unsigned int>(SQLite::OPEN_READONLY));
+            source = job_->source.get();
+        }
+
+        job_->backup = std::make_unique<SQLite::Backup>(*job_->destination, "main", *source, "main");
+    }
+
+    /// Publishes the finished backup and rotates out the oldest ones
+    [[nodiscard]]
+    auto finish() -> std::expected<void, Error>
+    {
+        auto& logger = common::Logger::instance();
+
+        try {
+            std::filesystem::rename(job_->directory, job_->final_directory);
+            logger.info("Backup completed: {}", job_->final_directory.string());
+            job_.reset();
+
+            auto backups = completed_backups();
+            while (backups.size() > BACKUP_KEEP_COUNT) {
+                logger.info("Removing old backup: {}", backups.front().string());
+                std::filesystem::remove_all(backups.front());
+                backups.erase(backups.begin());
+            }
+        }
+        catch (const std::filesystem::filesystem_error& e) {
+            return std::unexpected(make_system_error(std::format("Failed to rotate backups: {}", e.what())));
+        }
+
+        return {};
+    }
+
+    /// Drops the running backup and its partial files
+    auto abort() -> void
+    {
+        if (!job_) {
+            return;
+        }
+
+        const auto directory = job_->directory;
+        job_.reset();
+
+        std::error_code error;
+        std::filesystem::remove_all(directory, error);
+    }
+
+    /// Returns the completed backups, oldest first
+    [[nodiscard]]
+    auto completed_backups() const -> std::vector<std::filesystem::path>
+    {
+        std::vector<std::filesystem::path> backups;
+
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(backup_dir_, error)) {
+            if (entry.is_directory() && !entry.path().filename().string().starts_with('.')) {
+                backups.push_back(entry.path());
+            }
+        }
+
+        // Names are timestamps, so the lexicographic order is chronological
+        std::ranges::sort(backups);
+        return backups;
+    }
+
+    /// Removes backups left incomplete, e.g. by a crash
+    auto remove_stale_backups() const -> void
+    {
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(backup_dir_, error)) {
+            if (entry.path().filename().string().starts_with(IN_PROGRESS_PREFIX)) {
+                common::Logger::instance().warn("Removing incomplete backup: {}", entry.path().string());
+                std::filesystem::remove_all(entry.path(), error);
+            }
+        }
+    }
+
+    std::filesystem::path backup_dir_;
+    std::optional<Job> job_;
+    std::chrono::steady_clock::time_point next_check_;
+};
+
+} // namespace typetrace::backend
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "date.hpp"
+#include "modifier_state.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <linux/input-event-codes.h>
+#include <span>
+#include <tuple>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Counts presses of keys while modifiers are held, e.g. Ctrl+C or Alt+Tab
+///
+/// The counts of the current day live in a dense table indexed by (modifier mask, scan code),
+/// so counting a chord is an index computation and an increment. The cells touched since the
+/// last drain are kept in a dirty list, which turns them into sparse chord events.
+///
+/// With a capacity, drained events that would exceed it are first coalesced per day and chord.
+class ChordCounter final
+{
+  public:
+    ChordCounter() : counts_(MODIFIER_COMBINATIONS * KEY_COUNT) {}
+
+    /// Counts a key press with the held modifiers, modifiers on their own are no chord
+    auto record(ModifierMask modifiers, std::uint32_t key_code, std::chrono::year_month_day date) -> void
+    {
+        if (modifiers == 0 || key_code >= KEY_COUNT || ModifierState::is_modifier(key_code)) {
+            return;
+        }
+
+        // The table holds a single day
+        if (date != date_) {
+            drain();
+            date_ = date;
+        }
+
+        const auto cell = (static_cast<std::size_t>(modifiers) * KEY_COUNT) + key_code;
+        if (counts_[cell]++ == 0) {
+            dirty_.push_back(static_cast<std::uint32_t>(cell));
+        }
+    }
+
+    /// Limits the drained chord events to a capacity, as far as coalescing them allows
+    auto set_capacity(std::size_t capacity) -> void
+    {
+        capacity_ = capacity;
+        events_.reserve(capacity);
+    }
+
+    /// Moves the counts of the touched cells into chord events and clears them in the table
+    auto drain() -> void
+    {
+        if (capacity_ != 0 && events_.size() + dirty_.size() > capacity_) {
+            coalesce_events();
+        }
+
+        for (const auto cell : dirty_) {
+            events_.push_back({
+              .date = date_,
+              .key_code = static_cast<std::uint32_t>(cell % KEY_COUNT),
+              .modifiers = static_cast<std::uint8_t>(cell / KEY_COUNT),
+              .count = counts_[cell],
+            });
+            counts_[cell] = 0;
+        }
+        dirty_.clear();
+    }
+
+    /// Returns the drained chord events
+    [[nodiscard]]
+    auto events() const -> std::span<const common::ChordEvent>
+    {
+        return events_;
+    }
+
+    /// Drops the given number of drained chord events from the front after they have been flushed
+    auto drop_events(std::size_t count) -> void
+    {
+        events_.erase(events_.begin(), std::next(events_.begin(), static_cast<std::ptrdiff_t>(count)));
+    }
+
+    /// Returns the number of chord events a drain would leave, i.e. the drained plus the touched cells
+    [[nodiscard]]
+    auto pending_events() const -> std::size_t
+    {
+        return events_.size() + dirty_.size();
+    }
+
+    /// Returns the memory reserved by the dense table and its dirty list
+    [[nodiscard]]
+    auto table_bytes() const -> std::size_t
+    {
+        return (counts_.capacity() * sizeof(std::uint32_t)) + (dirty_.capacity() * sizeof(std::uint32_t));
+    }
+
+    /// Returns the memory reserved by the drained chord events
+    [[nodiscard]]
+    auto event_bytes() const -> std::size_t
+    {
+        return events_.capacity() * sizeof(common::ChordEvent);
+    }
+
+  private:
+    /// Number of evdev scan codes in the table
+    static constexpr std::size_t KEY_COUNT = KEY_CNT;
+
+    /// Merges drained events of the same day and chord, the day comes first so they stay chronological
+    auto coalesce_events() -> void
+    {
+        if (events_.empty()) {
+            return;
+        }
+
+        const auto key = [](const common::ChordEvent& event) -> std::tuple<std::int32_t, std::uint8_t, std::uint32_t> {
+            return {common::to_day_number(event.date), event.modifiers, event.key_code};
+        };
+
+        std::ranges::sort(events_, {}, key);
+        auto merged = events_.begin();
+        for (auto current = std::next(merged); current != events_.end(); ++current) {
+            if (key(*current) == key(*merged)) {
+                merged->count += current->count;
+            } else {
+                *++merged = *current;
+            }
+        }
+        events_.erase(std::next(merged), events_.end());
+    }
+
+    std::vector<std::uint32_t> counts_;
+    std::vector<std::uint32_t> dirty_;
+    std::vector<common::ChordEvent> events_;
+    std::chrono::year_month_day date_{};
+    std::size_t capacity_{0}; ///< Zero means unbounded
+};
+
+} // namespace typetrace::backend
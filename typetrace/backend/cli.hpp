@@ -1,20 +1,46 @@
 #pragma once
 
+#include "backup_manager.hpp"
+#include "clock.hpp"
+#include "column_store.hpp"
+#include "counter_merge.hpp"
 #include "database_manager.hpp"
 #include "errors.hpp"
 #include "event_handler.hpp"
+#include "ipc.hpp"
+#include "ipc_server.hpp"
+#include "keymap_cache.hpp"
+#include "keymap_names.hpp"
 #include "logger.hpp"
+#include "memory_budget.hpp"
+#include "partitions.hpp"
+#include "simulation.hpp"
+#include "startup_trace.hpp"
+#include "storage_benchmark.hpp"
+#include "storage_engine.hpp"
 #include "types.hpp"
 #include "version.hpp"
 
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <future>
+#include <initializer_list>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <poll.h>
 #include <print>
-#include <ranges>
+#include <random>
+#include <ratio>
 #include <span>
 #include <string_view>
+#include <system_error>
+#include <unistd.h>
 #include <vector>
 
 namespace typetrace::backend {
@@ -27,54 +53,452 @@ class Cli final
     static auto create(std::span<const char* const> args) -> std::expected<Cli, Error>
     {
         Cli cli;
-        parse_arguments(args);
+        if (cli.parse_arguments(args) != EXIT_SUCCESS) {
+            return std::unexpected(make_environment_error("Invalid command line arguments"));
+        }
 
-        const auto db_dir = TRY(get_database_dir());
-        auto db_mgr = TRY(DatabaseManager::create(db_dir));
-        cli.db_manager_ = std::make_unique<DatabaseManager>(std::move(db_mgr));
+        // The help and version output is all there is to do
+        if (cli.exit_after_parsing_) {
+            return cli;
+        }
 
-        auto evt_handler = TRY(EventHandler::create());
-        cli.event_handler_ = std::make_unique<EventHandler>(std::move(evt_handler));
+        // Merging, backups, simulations and benchmarks are one-shot commands that do not capture input
+        if (cli.merge_output_ || cli.backup_target_ || cli.simulation_seed_ || cli.benchmark_) {
+            return cli;
+        }
 
-        // Set up callback for EventHandler to flush buffer to database
-        cli.event_handler_->set_buffer_callback(
-          [&db_mgr_cb = cli.db_manager_](const std::vector<common::KeystrokeEvent>& buffer) -> void {
-              if (const auto result = db_mgr_cb->write_to_database(buffer); !result) {
-                  common::Logger::instance().error("Failed to write to database: {}", result.error().message);
-              }
+        // The SQLite limits are process-wide and have to be set before any connection is opened
+        if (cli.memory_budget_mib_ != 0) {
+            cli.memory_budget_ = TRY(MemoryBudget::from_mebibytes(cli.memory_budget_mib_));
+            cli.memory_budget_->apply();
+        }
+        const auto cache_size_kib = cli.memory_budget_ ? cli.memory_budget_->sqlite_cache_kib : 0;
+
+        // Opening the storage does not depend on the input devices, so it runs in the background
+        cli.pending_storage_ = std::async(
+          std::launch::async,
+          [startup_trace = cli.startup_trace_, storage_kind = cli.storage_kind_, cache_size_kib]
+            -> std::expected<std::unique_ptr<StorageEngine>, Error> {
+              const auto db_dir = TRY(startup_trace->measure("database directory", get_database_dir));
+              return startup_trace->measure("storage initialization", [&db_dir, storage_kind, cache_size_kib] {
+                  return open_storage(storage_kind, db_dir, cache_size_kib);
+              });
           });
 
+        // Compiling the keymap is independent of the input devices as well, it tells Alt from AltGr in chords
+        cli.pending_keymap_ = std::async(std::launch::async, [startup_trace = cli.startup_trace_] {
+            return startup_trace->measure(
+              "keymap tables", [] -> std::expected<KeymapCache, Error> {
+                  return KeymapCache::create(KeymapNames::configured());
+              });
+        });
+
+        auto evt_handler = TRY(EventHandler::create(*cli.startup_trace_));
+        cli.event_handler_ = std::make_unique<EventHandler>(std::move(evt_handler));
+
+        // Characters can only be counted with the keymap, without them capture starts right away
+        if (cli.track_characters_) {
+            cli.event_handler_->enable_character_tracking(TRY(cli.pending_keymap_.get()));
+        }
+
+        if (cli.memory_budget_) {
+            cli.event_handler_->set_buffer_capacity(cli.memory_budget_->buffer_capacity);
+        }
+
         return cli;
     }
 
     /// Runs the main event loop for keystroke tracing
     auto run() -> std::expected<void, Error>
     {
-        while (true) { // TODO(domi): Use event handler to quit
-            event_handler_->trace();
+        if (exit_after_parsing_) {
+            return {};
+        }
+
+        if (merge_output_) {
+            const auto stats = TRY(CounterMerge::merge(merge_inputs_, *merge_output_));
+            std::println("Merged {} databases into {} ({} rows, {} totals)",
+                         stats.inputs,
+                         merge_output_->string(),
+                         stats.rows_written,
+                         stats.totals);
+            return {};
+        }
+
+        if (backup_target_) {
+            const auto db_dir = TRY(get_database_dir());
+            const auto target = backup_target_->empty()
+                                ? db_dir / BACKUP_DIR_NAME / BackupManager::timestamp_name()
+                                : *backup_target_;
+            const auto partitions = TRY(BackupManager::snapshot(db_dir, target));
+            std::println("Wrote snapshot of {} partitions to {}", partitions, target.string());
+            return {};
+        }
+
+        if (simulation_seed_) {
+            return simulate(*simulation_seed_);
+        }
+
+        if (benchmark_) {
+            return benchmark();
+        }
+
+        start_ipc_server();
+
+        while (running_) {
+            // Capture starts right away, the buffer is flushed once the storage is ready
+            if (pending_storage_.valid()
+                && pending_storage_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                TRY(attach_storage());
+            }
+            if (pending_keymap_.valid()
+                && pending_keymap_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                attach_keymap();
+            }
+
+            poll_events();
+
+            if (backup_manager_) {
+                if (const auto result = backup_manager_->tick(*db_manager_); !result) {
+                    common::Logger::instance().error("Backup failed: {}", result.error().message);
+                }
+            }
+
+            if (memory_budget_ && Clock::now() >= next_memory_report_) {
+                enforce_memory_budget();
+                next_memory_report_ = Clock::now() + std::chrono::seconds(MEMORY_REPORT_INTERVAL);
+            }
         }
+
+        // Nothing buffered may be lost on shutdown, so wait for the storage if it is still opening
+        if (pending_storage_.valid()) {
+            TRY(attach_storage());
+        }
+        event_handler_->finish();
+
+        common::Logger::instance().info("Backend stopped");
+        return {};
     }
 
   private:
     Cli() = default;
 
+    /// Opens the selected storage engine in the given directory
+    [[nodiscard]]
+    static auto open_storage(StorageKind storage_kind, const std::filesystem::path& db_dir, std::size_t cache_size_kib)
+      -> std::expected<std::unique_ptr<StorageEngine>, Error>
+    {
+        switch (storage_kind) {
+            case StorageKind::SQLITE: {
+                auto db_mgr = TRY(DatabaseManager::create(db_dir, cache_size_kib));
+                return std::make_unique<DatabaseManager>(std::move(db_mgr));
+            }
+            case StorageKind::COLUMNAR: {
+                auto column_store = TRY(ColumnStore::create(db_dir));
+                return std::make_unique<ColumnStore>(std::move(column_store));
+            }
+        }
+
+        return std::unexpected(make_environment_error("Unknown storage engine"));
+    }
+
+    /// Runs the seeded simulation scenarios, then the first ones against the selected storage engine
+    [[nodiscard]]
+    auto simulate(std::uint64_t seed) const -> std::expected<void, Error>
+    {
+        // Every injected write failure would be logged, violations are printed by the simulation
+        common::Logger::instance().set_level(spdlog::level::off);
+
+        const auto started = Clock::now();
+        const auto report = Simulation::run(seed, SIMULATION_SCENARIOS);
+        const auto elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+        const auto hours = std::chrono::duration<double, std::ratio<3600>>(report.simulated_time).count();
+
+        std::println("Simulated {} scenarios from seed {}: {:.0f} hours, {} key presses",
+                     report.scenarios,
+                     seed,
+                     hours,
+                     report.key_presses);
+        std::println("Injected {} failed writes and {} abrupt terminations, ran {:.0f} simulated hours per second",
+                     report.failed_writes,
+                     report.abrupt_terminations,
+                     hours / elapsed);
+        if (!report.characters_checked) {
+            std::println("Typed characters were not checked, the keymap of the US layout could not be compiled");
+        }
+
+        std::error_code error;
+        const auto dir = std::filesystem::temp_directory_path(error) / std::format("typetrace-simulation-{}", getpid());
+        if (error) {
+            return std::unexpected(make_system_error("Failed to find the temporary directory"));
+        }
+
+        const auto open_simulated_storage = [this, &dir] -> std::expected<std::unique_ptr<StorageEngine>, Error> {
+            return open_storage(storage_kind_, dir, 0);
+        };
+        const auto durable = Simulation::run_durable(seed, SIMULATION_STORAGE_SCENARIOS, dir, open_simulated_storage);
+        std::filesystem::remove_all(dir, error);
+
+        std::println("Reopened the real storage after {} scenarios, {} of them killed before a clean shutdown",
+                     durable.scenarios,
+                     durable.abrupt_terminations);
+
+        if (report.violations != 0 || durable.violations != 0) {
+            return std::unexpected(make_environment_error("Simulation found invariant violations, see above"));
+        }
+        std::println("All invariants held");
+        return {};
+    }
+
+    /// Compares the storage engines on a synthetic history in a temporary directory
+    [[nodiscard]]
+    static auto benchmark() -> std::expected<void, Error>
+    {
+        // The partition switches of the SQLite storage would be logged for every year of the history
+        common::Logger::instance().set_level(spdlog::level::warn);
+
+        std::error_code error;
+        const auto dir = std::filesystem::temp_directory_path(error) / std::format("typetrace-benchmark-{}", getpid());
+        if (error) {
+            return std::unexpected(make_system_error("Failed to find the temporary directory"));
+        }
+
+        std::println("Writing {} days of {} batches with {} key presses to each storage engine...",
+                     BENCHMARK_DAYS,
+                     BENCHMARK_BATCHES_PER_DAY,
+                     BUFFER_SIZE);
+
+        std::vector<BenchmarkResult> results;
+        for (const auto storage_kind : {StorageKind::SQLITE, StorageKind::COLUMNAR}) {
+            auto result = benchmark_engine(storage_kind, dir);
+            std::filesystem::remove_all(dir, error);
+            if (!result) {
+                return std::unexpected(result.error());
+            }
+            results.push_back(*result);
+        }
+
+        std::println("{:<10} {:>14} {:>12} {:>12} {:>12} {:>12}",
+                     "Engine",
+                     "Write/batch",
+                     "File size",
+                     "Query 7d",
+                     "Query 365d",
+                     std::format("Query {}d", BENCHMARK_DAYS));
+        for (const auto& result : results) {
+            constexpr double MEBIBYTE = 1024.0 * 1024.0;
+            std::println("{:<10} {:>12.1f}us {:>9.2f}MiB {:>10.3f}ms {:>10.3f}ms {:>10.3f}ms",
+                         result.engine,
+                         result.write_per_batch.count(),
+                         static_cast<double>(result.file_bytes) / MEBIBYTE,
+                         result.query_latency[0].count(),
+                         result.query_latency[1].count(),
+                         result.query_latency[2].count());
+        }
+
+        return {};
+    }
+
+    /// Runs the storage benchmark on a new storage of the given kind in the given directory
+    [[nodiscard]]
+    static auto benchmark_engine(StorageKind storage_kind, const std::filesystem::path& dir)
+      -> std::expected<BenchmarkResult, Error>
+    {
+        std::error_code error;
+        std::filesystem::create_directories(dir, error);
+        if (error) {
+            return std::unexpected(make_system_error("Failed to create the benchmark directory"));
+        }
+
+        auto storage = TRY(open_storage(storage_kind, dir, 0));
+        return StorageBenchmark::run(*storage, dir);
+    }
+
+    /// Starts serving the IPC socket, the backend keeps running without it if that fails
+    auto start_ipc_server() -> void
+    {
+        IpcServer::Handlers handlers{
+          .flush = [this] -> bool { return event_handler_->flush(); },
+          .buffer_stats = [this] -> IpcServer::BufferStats {
+              return {.buffered_events = event_handler_->buffered_events(), .flushes = event_handler_->flush_count()};
+          },
+          .reload_config = [](const common::ipc::ConfigMessage& config) -> void {
+              common::Logger::instance().set_level(static_cast<spdlog::level::level_enum>(config.log_level));
+          },
+          .stop = [this] -> void { running_ = false; },
+        };
+
+        const auto socket_path = common::ipc::socket_path();
+        if (!socket_path) {
+            common::Logger::instance().warn("IPC is disabled: the socket directory is not private to the user");
+            return;
+        }
+
+        auto server = IpcServer::create(*socket_path, std::move(handlers));
+        if (!server) {
+            common::Logger::instance().warn("IPC is disabled: {}", server.error().message);
+            return;
+        }
+        ipc_server_ = std::move(*server);
+
+        event_handler_->set_keystroke_observer(
+          [server_ptr = &*ipc_server_](std::uint32_t key_code) -> void { server_ptr->record_keystroke(key_code); });
+    }
+
+    /// Waits for input events and IPC clients at once, then handles whatever is ready
+    ///
+    /// A single poll keeps IPC requests from waiting behind the input poll timeout.
+    auto poll_events() -> void
+    {
+        poll_fds_.clear();
+        poll_fds_.push_back({.fd = event_handler_->fd(), .events = POLLIN, .revents = 0});
+        if (ipc_server_) {
+            ipc_server_->add_poll_fds(poll_fds_);
+        }
+
+        if (::poll(poll_fds_.data(), poll_fds_.size(), POLL_TIMEOUT_MS) < 0) {
+            if (errno != EINTR) {
+                common::Logger::instance().error("Poll failed with error: {}", std::strerror(errno));
+            }
+            for (auto& poll_fd : poll_fds_) {
+                poll_fd.revents = 0;
+            }
+        }
+
+        event_handler_->trace(poll_fds_.front().revents);
+        if (ipc_server_) {
+            ipc_server_->handle_events(std::span(poll_fds_).subspan(1));
+        }
+    }
+
+    /// Takes over the storage opened in the background and connects it to the event handler
+    [[nodiscard]]
+    auto attach_storage() -> std::expected<void, Error>
+    {
+        storage_ = TRY(pending_storage_.get());
+        common::Logger::instance().info("Using the {} storage engine", storage_->name());
+
+        // Online backups use the SQLite backup API and are only available with the SQLite engine
+        db_manager_ = dynamic_cast<DatabaseManager*>(storage_.get());
+        if (db_manager_ != nullptr) {
+            backup_manager_ = std::make_unique<BackupManager>(db_manager_->directory() / BACKUP_DIR_NAME);
+            db_manager_->set_close_hook([backup_manager = backup_manager_.get()] -> void {
+                backup_manager->release_connection();
+            });
+        }
+
+        // Set up callback for EventHandler to flush buffer to the storage
+        event_handler_->set_buffer_callback(
+          [storage = storage_.get()](const common::FlushBatch& batch) -> std::expected<void, Error> {
+              return storage->write(batch);
+          });
+
+        startup_trace_->report();
+        return {};
+    }
+
+    /// Reports the memory usage, going over the budget flushes the buffers and releases free memory
+    auto enforce_memory_budget() -> void
+    {
+        const auto usage = MemoryUsage::measure(event_handler_->memory());
+        if (memory_budget_->report(usage)) {
+            return;
+        }
+
+        event_handler_->flush();
+        MemoryBudget::release_free_memory();
+        const auto after = MemoryUsage::measure(event_handler_->memory()).rss_bytes;
+
+        auto& logger = common::Logger::instance();
+        if (after > memory_budget_->total_bytes) {
+            logger.warn("Memory usage of {} KiB exceeds the budget of {} KiB after releasing free memory",
+                        after / 1024,
+                        memory_budget_->total_bytes / 1024);
+        } else {
+            logger.info("Released free memory, usage went from {} KiB to {} KiB", usage.rss_bytes / 1024, after / 1024);
+        }
+    }
+
+    /// Takes over the keymap compiled in the background, until then right Alt chords count as Alt
+    auto attach_keymap() -> void
+    {
+        if (auto keymap = pending_keymap_.get()) {
+            event_handler_->apply_keymap_modifiers(*keymap);
+        } else {
+            common::Logger::instance().warn("Counting right Alt chords as Alt: {}", keymap.error().message);
+        }
+    }
+
     /// Parses and processes command line arguments
-    static auto parse_arguments(std::span<const char* const> args) -> int
+    auto parse_arguments(std::span<const char* const> args) -> int
     {
-        for (const auto i : std::views::iota(1U, args.size())) {
+        for (std::size_t i = 1; i < args.size(); ++i) {
             const std::string_view arg = args[i];
 
             if (arg == "-h" || arg == "--help") {
                 show_help(args[0]);
+                exit_after_parsing_ = true;
                 return EXIT_SUCCESS;
             }
             if (arg == "-v" || arg == "--version") {
                 show_version();
+                exit_after_parsing_ = true;
                 return EXIT_SUCCESS;
             }
             if (arg == "-d" || arg == "--debug") {
                 auto& logger = common::Logger::instance();
                 logger.debug("Debug mode enabled");
+            } else if (arg == "-c" || arg == "--characters") {
+                track_characters_ = true;
+            } else if (arg == "-s" || arg == "--storage") {
+                const auto storage_kind = i + 1 < args.size() ? parse_storage_kind(args[++i]) : std::nullopt;
+                if (!storage_kind) {
+                    std::println(std::cerr, "Option {} expects one of: sqlite, columnar", arg);
+                    show_help(args[0]);
+                    return EXIT_FAILURE;
+                }
+                storage_kind_ = *storage_kind;
+            } else if (arg == "-M" || arg == "--memory-budget") {
+                const std::string_view value = i + 1 < args.size() ? args[++i] : "";
+                const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), memory_budget_mib_);
+                if (value.empty() || ec != std::errc{} || ptr != value.data() + value.size()) {
+                    std::println(std::cerr, "Option {} expects a size in MiB", arg);
+                    show_help(args[0]);
+                    return EXIT_FAILURE;
+                }
+            } else if (arg == "-b" || arg == "--backup") {
+                // The target directory is optional
+                if (i + 1 < args.size() && !std::string_view(args[i + 1]).starts_with('-')) {
+                    backup_target_ = args[++i];
+                } else {
+                    backup_target_ = std::filesystem::path();
+                }
+            } else if (arg == "-S" || arg == "--simulate") {
+                // The seed is optional, a random one is printed so that the run can be repeated
+                simulation_seed_ = std::random_device{}();
+                if (i + 1 < args.size() && !std::string_view(args[i + 1]).starts_with('-')) {
+                    const std::string_view value = args[++i];
+                    const auto [ptr, ec] =
+                      std::from_chars(value.data(), value.data() + value.size(), *simulation_seed_);
+                    if (ec != std::errc{} || ptr != value.data() + value.size()) {
+                        std::println(std::cerr, "Option {} expects a numeric seed", arg);
+                        show_help(args[0]);
+                        return EXIT_FAILURE;
+                    }
+                }
+            } else if (arg == "-B" || arg == "--benchmark") {
+                benchmark_ = true;
+            } else if (arg == "-m" || arg == "--merge") {
+                // The output is followed by all remaining arguments as inputs
+                if (i + 2 >= args.size()) {
+                    std::println(std::cerr, "Option {} expects an output and at least one input database", arg);
+                    show_help(args[0]);
+                    return EXIT_FAILURE;
+                }
+                merge_output_ = args[++i];
+                while (++i < args.size()) {
+                    merge_inputs_.emplace_back(args[i]);
+                }
             } else {
                 std::println(std::cerr, "Unknown option: {}", arg);
                 show_help(args[0]);
@@ -82,6 +506,15 @@ class Cli final
             }
         }
 
+        // The columnar store only holds scan code counts
+        if (storage_kind_ == StorageKind::COLUMNAR) {
+            if (track_characters_) {
+                std::println(std::cerr, "Option --characters needs the sqlite storage engine");
+                return EXIT_FAILURE;
+            }
+            std::println(std::cerr, "Warning: the columnar storage engine does not store chords and typing sessions");
+        }
+
         return EXIT_SUCCESS;
     }
 
@@ -98,6 +531,17 @@ Options:
  -h, --help      Display help then exit.
  -v, --version   Display version then exit.
  -d, --debug     Enable debug mode.
+ -c, --characters
+                 Also count the typed characters of the keyboard layout.
+ -s, --storage   Storage engine to use: sqlite (default) or columnar.
+                 The columnar engine only counts key presses.
+ -M, --memory-budget
+                 Limit memory usage to the given size in MiB.
+ -b, --backup    Write a compacted snapshot: --backup [DIR] then exit.
+ -m, --merge     Merge databases: --merge OUTPUT INPUT... then exit.
+ -S, --simulate  Run seeded stress scenarios: --simulate [SEED] then exit.
+                 The first ones also run on the engine given by --storage.
+ -B, --benchmark Compare the storage engines on synthetic data then exit.
 
 Warning: This is the backend and is not designed to run by users.
 You should run the frontend of TypeTrace which will run this.
@@ -116,29 +560,50 @@ You should run the frontend of TypeTrace which will run this.
     [[nodiscard]]
     static auto get_database_dir() -> std::expected<std::filesystem::path, Error>
     {
-        const char* home = std::getenv("HOME");
-        if (home == nullptr) {
+        auto db_dir = common::database_dir();
+        if (!db_dir) {
             return std::unexpected(make_system_error("HOME environment variable not set"));
         }
 
-        auto db_dir = std::filesystem::path(home) / ".local" / "share" / PROJECT_NAME;
-
         try {
-            if (!std::filesystem::exists(db_dir)) {
-                std::filesystem::create_directories(db_dir);
+            if (!std::filesystem::exists(*db_dir)) {
+                std::filesystem::create_directories(*db_dir);
                 auto& logger = common::Logger::instance();
-                logger.info("Created database directory: {}", db_dir.string());
+                logger.info("Created database directory: {}", db_dir->string());
             }
         }
         catch (const std::filesystem::filesystem_error& e) {
             return std::unexpected(make_system_error(std::format("Failed to create database directory: {}", e.what())));
         }
 
-        return db_dir;
+        return *db_dir;
     }
 
+    StorageKind storage_kind_{StorageKind::SQLITE};
+    std::optional<std::filesystem::path> merge_output_;
+    std::vector<std::filesystem::path> merge_inputs_;
+    std::optional<std::filesystem::path> backup_target_;
+    std::size_t memory_budget_mib_{0};
+    std::optional<std::uint64_t> simulation_seed_;
+    bool benchmark_{false};
+    bool track_characters_{false};
+    bool exit_after_parsing_{false};
+
+    std::optional<MemoryBudget> memory_budget_;
+    Clock::time_point next_memory_report_;
+
+    std::shared_ptr<common::StartupTrace> startup_trace_ = std::make_shared<common::StartupTrace>();
+    std::future<std::expected<std::unique_ptr<StorageEngine>, Error>> pending_storage_;
+    std::future<std::expected<KeymapCache, Error>> pending_keymap_; ///< Consumed at startup with --characters
+
     std::unique_ptr<EventHandler> event_handler_;
-    std::unique_ptr<DatabaseManager> db_manager_;
+    std::unique_ptr<StorageEngine> storage_;
+    DatabaseManager* db_manager_{nullptr};
+    std::unique_ptr<BackupManager> backup_manager_;
+
+    bool running_{true};
+    std::optional<IpcServer> ipc_server_;
+    std::vector<pollfd> poll_fds_; ///< The input devices, then the IPC sockets
 };
 
 } // namespace typetrace::backend
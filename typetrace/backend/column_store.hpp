@@ -0,0 +1,541 @@
+#pragma once
+
+#include "constants.hpp"
+#include "date.hpp"
+#include "errors.hpp"
+#include "logger.hpp"
+#include "macros.hpp"
+#include "storage_engine.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <expected>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <linux/input-event-codes.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Native append-only, memory-mapped columnar implementation of the storage engine
+///
+/// File layout:
+///
+/// +-------------+-----------+-----------+-----+
+/// | FileHeader  | DayBlock  | DayBlock  | ... |
+/// +-------------+-----------+-----------+-----+
+///
+/// Every day block holds a fixed-width column of counts indexed by scan code. Blocks are only
+/// ever appended, the block of a day is updated in place. The index from day to block is kept
+/// in memory and rebuilt from the block headers when the file is opened.
+///
+/// A new block is synced before the header counts it, and every write is synced before it
+/// returns. Each block carries a checksum of its day and counts. After a crash during a write,
+/// the pages of a block may reach the disk only in part. The checksum then no longer matches,
+/// and the block is reported and resealed when the file is opened.
+class ColumnStore final : public StorageEngine
+{
+  public:
+    /// Factory method to create a ColumnStore instance
+    [[nodiscard]]
+    static auto create(const std::filesystem::path& db_dir) -> std::expected<ColumnStore, Error>
+    {
+        ColumnStore store;
+        store.file_ = db_dir / COLUMN_STORE_FILE_NAME;
+
+        common::Logger::instance().info("Initializing columnar store at: {}", store.file_.string());
+
+        // A new file gets its header before it appears under its name, so a crash never leaves a headerless file
+        std::error_code error;
+        if (!std::filesystem::exists(store.file_, error) || std::filesystem::file_size(store.file_, error) == 0) {
+            TRY(initialize_file(store.file_));
+        }
+
+        store.fd_ = ::open(store.file_.c_str(), O_RDWR | O_CLOEXEC);
+        if (store.fd_ < 0) {
+            return std::unexpected(make_database_error(
+              std::format("Failed to open columnar store '{}': {}", store.file_.string(), std::strerror(errno))));
+        }
+
+        struct stat file_stat{};
+        if (fstat(store.fd_, &file_stat) < 0) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to stat columnar store: {}", std::strerror(errno))));
+        }
+
+        TRY(store.map(static_cast<std::size_t>(file_stat.st_size)));
+        TRY(store.validate());
+        TRY(store.verify_blocks());
+
+        store.build_index();
+        common::Logger::instance().info("Columnar store opened with {} day blocks", store.header().block_count);
+
+        return store;
+    }
+
+    ColumnStore(const ColumnStore&) = delete;
+    auto operator=(const ColumnStore&) -> ColumnStore& = delete;
+
+    ColumnStore(ColumnStore&& other) noexcept
+        : StorageEngine(std::move(other)),
+          file_(std::move(other.file_)),
+          fd_(std::exchange(other.fd_, -1)),
+          mapping_(std::exchange(other.mapping_, nullptr)),
+          mapping_size_(std::exchange(other.mapping_size_, 0)),
+          index_(std::move(other.index_)),
+          skipped_events_reported_(other.skipped_events_reported_)
+    {}
+
+    auto operator=(ColumnStore&& other) noexcept -> ColumnStore&
+    {
+        if (this != &other) {
+            release();
+            StorageEngine::operator=(std::move(other));
+            file_ = std::move(other.file_);
+            fd_ = std::exchange(other.fd_, -1);
+            mapping_ = std::exchange(other.mapping_, nullptr);
+            mapping_size_ = std::exchange(other.mapping_size_, 0);
+            index_ = std::move(other.index_);
+            skipped_events_reported_ = other.skipped_events_reported_;
+        }
+        return *this;
+    }
+
+    ~ColumnStore() override
+    {
+        release();
+    }
+
+    /// Adds the counts of a batch of keystroke events to their day blocks
+    ///
+    /// The columnar store only holds scan code counts, other statistics in the batch are skipped.
+    [[nodiscard]]
+    auto write(const common::FlushBatch& batch) -> std::expected<void, Error> override
+    {
+        if (!skipped_events_reported_
+            && (!batch.characters.empty() || !batch.chords.empty() || !batch.sessions.empty())) {
+            common::Logger::instance().warn(
+              "The columnar store only counts scan codes, skipping {} characters, {} chords and {} typing sessions "
+              "of this batch and any after it",
+              batch.characters.size(),
+              batch.chords.size(),
+              batch.sessions.size());
+            skipped_events_reported_ = true;
+        }
+
+        if (batch.keystrokes.empty()) {
+            return {};
+        }
+
+        // Growing the file is the only step that can fail, so all blocks are added before any count.
+        // A failed write then leaves the counts untouched and the event handler can retry the batch.
+        for (const auto& event : batch.keystrokes) {
+            TRY(block_for(common::to_day_number(event.date)));
+        }
+
+        std::vector<std::uint32_t> written_blocks;
+        for (const auto& event : batch.keystrokes) {
+            if (event.key_code >= KEY_COUNT) {
+                common::Logger::instance().warn("Ignoring out of range scan code {} in columnar store",
+                                                event.key_code);
+                continue;
+            }
+
+            const auto block = TRY(block_for(common::to_day_number(event.date)));
+            blocks()[block].counts.at(event.key_code) += event.count;
+            if (written_blocks.empty() || written_blocks.back() != block) {
+                written_blocks.push_back(block);
+            }
+        }
+
+        std::ranges::sort(written_blocks);
+        written_blocks.erase(std::ranges::unique(written_blocks).begin(), written_blocks.end());
+        for (const auto block : written_blocks) {
+            blocks()[block].checksum = checksum_of(blocks()[block]);
+        }
+
+        // The counts are in the mapping already, so a failed sync must not make the batch count twice
+        if (msync(mapping_, mapping_size_, MS_SYNC) < 0) {
+            common::Logger::instance().warn("Failed to sync columnar store, a crash may lose the last batch: {}",
+                                            std::strerror(errno));
+        }
+
+        common::Logger::instance().debug(
+          "Inserted {} keystrokes into the columnar store: {}", batch.keystrokes.size(), file_.string());
+        return {};
+    }
+
+    /// Returns the total amount of key presses per day between two dates (inclusive)
+    [[nodiscard]]
+    auto daily_counts(std::chrono::year_month_day from, std::chrono::year_month_day to)
+      -> std::expected<std::vector<common::DailyCount>, Error> override
+    {
+        std::vector<common::DailyCount> counts;
+
+        const auto first_day = common::to_day_number(from);
+        const auto last_day = common::to_day_number(to);
+
+        auto entry = std::ranges::lower_bound(index_, first_day, {}, &IndexEntry::day);
+        for (; entry != index_.end() && entry->day <= last_day; ++entry) {
+            const auto& block_counts = blocks()[entry->block].counts;
+
+            std::uint64_t total = 0;
+            for (const auto count : block_counts) {
+                total += count;
+            }
+
+            if (total != 0) {
+                counts.push_back({.date = common::from_day_number(entry->day), .total = total});
+            }
+        }
+
+        return counts;
+    }
+
+    /// Returns the name of the storage engine
+    [[nodiscard]]
+    auto name() const -> std::string_view override
+    {
+        return "columnar";
+    }
+
+  private:
+    /// Number of count columns per day block, one per evdev scan code
+    static constexpr std::size_t KEY_COUNT = KEY_CNT;
+
+    /// Identifies the file format and its version
+    static constexpr std::array<char, 8> MAGIC = {'T', 'T', 'C', 'O', 'L', 'S', '\0', '\0'};
+    static constexpr std::uint32_t VERSION = 2;
+
+    /// Version without block checksums, its files get them when they are opened
+    static constexpr std::uint32_t UNCHECKED_VERSION = 1;
+
+    /// Header at the start of the file
+    struct FileHeader
+    {
+        std::array<char, 8> magic;
+        std::uint32_t version;
+        std::uint32_t key_count;
+        std::uint32_t block_count;
+        std::array<std::uint32_t, 3> reserved;
+    };
+
+    static_assert(sizeof(FileHeader) == 32);
+
+    /// Fixed-width block with the counts of a single day
+    struct DayBlock
+    {
+        std::int32_t day;
+        std::uint32_t checksum; ///< Of the day and the counts, see checksum_of()
+        std::array<std::uint32_t, KEY_COUNT> counts;
+    };
+
+    /// Maps a day to the position of its block in the file
+    struct IndexEntry
+    {
+        std::int32_t day;
+        std::uint32_t block;
+    };
+
+    /// Private constructor - use create() factory method
+    ColumnStore() = default;
+
+    /// Returns the file size needed to hold the given amount of day blocks
+    [[nodiscard]]
+    static constexpr auto file_size_for(std::size_t capacity) -> std::size_t
+    {
+        return sizeof(FileHeader) + (capacity * sizeof(DayBlock));
+    }
+
+    /// Returns the amount of day blocks that fit into the current mapping
+    [[nodiscard]]
+    auto block_capacity() const -> std::size_t
+    {
+        return (mapping_size_ - sizeof(FileHeader)) / sizeof(DayBlock);
+    }
+
+    [[nodiscard]]
+    auto header() const -> FileHeader&
+    {
+        return *static_cast<FileHeader*>(mapping_);
+    }
+
+    [[nodiscard]]
+    auto blocks() const -> DayBlock*
+    {
+        return static_cast<DayBlock*>(static_cast<void*>(static_cast<std::byte*>(mapping_) + sizeof(FileHeader)));
+    }
+
+    /// Creates a new, empty file with its header in a temporary file and renames it into place
+    [[nodiscard]]
+    static auto initialize_file(const std::filesystem::path& file) -> std::expected<void, Error>
+    {
+        auto temp_file = file;
+        temp_file += ".tmp";
+
+        const int fd = ::open(temp_file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to create columnar store: {}", std::strerror(errno))));
+        }
+
+        const FileHeader file_header{
+          .magic = MAGIC, .version = VERSION, .key_count = KEY_COUNT, .block_count = 0, .reserved = {}};
+        const auto size = file_size_for(COLUMN_STORE_GROWTH_BLOCKS);
+
+        const bool written = ftruncate(fd, static_cast<off_t>(size)) == 0
+                          && pwrite(fd, &file_header, sizeof(file_header), 0)
+                               == static_cast<ssize_t>(sizeof(file_header))
+                          && fsync(fd) == 0;
+        const int write_error = errno;
+        ::close(fd);
+
+        if (!written || ::rename(temp_file.c_str(), file.c_str()) < 0) {
+            const int error = written ? errno : write_error;
+            ::unlink(temp_file.c_str());
+            return std::unexpected(
+              make_database_error(std::format("Failed to initialize columnar store: {}", std::strerror(error))));
+        }
+
+        // The rename is only durable once the directory holding the new entry is synced
+        const int dir_fd = ::open(file.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        const bool synced = dir_fd >= 0 && fsync(dir_fd) == 0;
+        const int sync_error = errno;
+        if (dir_fd >= 0) {
+            ::close(dir_fd);
+        }
+
+        if (!synced) {
+            return std::unexpected(make_database_error(
+              std::format("Failed to sync the directory of the columnar store: {}", std::strerror(sync_error))));
+        }
+
+        return {};
+    }
+
+    /// Memory-maps the given amount of bytes of the file
+    [[nodiscard]]
+    auto map(std::size_t size) -> std::expected<void, Error>
+    {
+        if (size < sizeof(FileHeader)) {
+            return std::unexpected(make_database_error("Columnar store is truncated"));
+        }
+
+        void* const mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapping == MAP_FAILED) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to map columnar store: {}", std::strerror(errno))));
+        }
+
+        mapping_ = mapping;
+        mapping_size_ = size;
+        return {};
+    }
+
+    /// Checks that the mapped file is a columnar store this version can read
+    [[nodiscard]]
+    auto validate() const -> std::expected<void, Error>
+    {
+        const auto& file_header = header();
+
+        if (file_header.magic != MAGIC
+            || (file_header.version != VERSION && file_header.version != UNCHECKED_VERSION)) {
+            return std::unexpected(make_database_error("Columnar store has an unknown format"));
+        }
+        if (file_header.key_count != KEY_COUNT) {
+            return std::unexpected(make_database_error("Columnar store was created with a different key count"));
+        }
+        if (mapping_size_ < file_size_for(file_header.block_count)) {
+            return std::unexpected(make_database_error("Columnar store is truncated"));
+        }
+
+        return {};
+    }
+
+    /// Checks the block checksums and reseals the blocks a crash left partly written
+    ///
+    /// The counts of such a block are kept: each of them is either from before or after the write
+    /// that was interrupted. Files of the unchecked version get their first checksums.
+    [[nodiscard]]
+    auto verify_blocks() -> std::expected<void, Error>
+    {
+        auto& file_header = header();
+        const bool unchecked = file_header.version == UNCHECKED_VERSION;
+
+        std::size_t resealed = 0;
+        for (std::uint32_t block = 0; block < file_header.block_count; ++block) {
+            auto& day_block = blocks()[block];
+            const auto checksum = checksum_of(day_block);
+            if (day_block.checksum == checksum) {
+                continue;
+            }
+
+            if (!unchecked) {
+                common::Logger::instance().warn(
+                  "Day block of {} was partly written before a crash, its counts may lack the last write",
+                  common::format_date(common::from_day_number(day_block.day)));
+            }
+            day_block.checksum = checksum;
+            ++resealed;
+        }
+
+        if (resealed == 0 && !unchecked) {
+            return {};
+        }
+
+        file_header.version = VERSION;
+        if (msync(mapping_, mapping_size_, MS_SYNC) < 0) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to sync columnar store: {}", std::strerror(errno))));
+        }
+        return {};
+    }
+
+    /// Returns the FNV-1a hash of the day and the counts of a block
+    [[nodiscard]]
+    static auto checksum_of(const DayBlock& day_block) -> std::uint32_t
+    {
+        constexpr std::uint32_t OFFSET_BASIS = 2166136261U;
+        constexpr std::uint32_t PRIME = 16777619U;
+
+        std::uint32_t hash = OFFSET_BASIS;
+        const auto add = [&hash](std::uint32_t value) -> void {
+            for (unsigned int shift = 0; shift < 32; shift += 8) {
+                hash = (hash ^ ((value >> shift) & 0xFFU)) * PRIME;
+            }
+        };
+
+        add(static_cast<std::uint32_t>(day_block.day));
+        for (const auto count : day_block.counts) {
+            add(count);
+        }
+        return hash;
+    }
+
+    /// Rebuilds the in-memory day index from the block headers
+    auto build_index() -> void
+    {
+        const auto block_count = header().block_count;
+
+        index_.clear();
+        index_.reserve(block_count);
+        for (std::uint32_t block = 0; block < block_count; ++block) {
+            index_.push_back({.day = blocks()[block].day, .block = block});
+        }
+
+        std::ranges::sort(index_, {}, &IndexEntry::day);
+    }
+
+    /// Returns the block of the given day, appending a new block if the day has none yet
+    [[nodiscard]]
+    auto block_for(std::int32_t day) -> std::expected<std::uint32_t, Error>
+    {
+        // Writes almost always go to the latest day
+        if (!index_.empty() && index_.back().day == day) {
+            return index_.back().block;
+        }
+
+        const auto entry = std::ranges::lower_bound(index_, day, {}, &IndexEntry::day);
+        if (entry != index_.end() && entry->day == day) {
+            return entry->block;
+        }
+
+        const auto position = entry - index_.begin();
+        const auto block = TRY(append_block(day));
+        index_.insert(index_.begin() + position, {.day = day, .block = block});
+
+        return block;
+    }
+
+    /// Appends a zeroed block for the given day, growing the file if necessary
+    [[nodiscard]]
+    auto append_block(std::int32_t day) -> std::expected<std::uint32_t, Error>
+    {
+        const auto block = header().block_count;
+
+        if (block >= block_capacity()) {
+            TRY(grow(block_capacity() + COLUMN_STORE_GROWTH_BLOCKS));
+        }
+
+        auto& day_block = blocks()[block];
+        day_block.day = day;
+        day_block.counts.fill(0);
+        day_block.checksum = checksum_of(day_block);
+
+        // The header may only count the block once it is on disk, or a crash could leave a block without a day
+        const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const auto offset = file_size_for(block);
+        const auto page_offset = offset - (offset % page_size);
+        if (msync(static_cast<std::byte*>(mapping_) + page_offset,
+                  offset + sizeof(DayBlock) - page_offset,
+                  MS_SYNC)
+            < 0) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to sync new day block: {}", std::strerror(errno))));
+        }
+
+        header().block_count = block + 1;
+
+        return block;
+    }
+
+    /// Extends the file and its mapping to hold the given amount of day blocks
+    [[nodiscard]]
+    auto grow(std::size_t capacity) -> std::expected<void, Error>
+    {
+        const auto size = file_size_for(capacity);
+
+        if (ftruncate(fd_, static_cast<off_t>(size)) < 0) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to grow columnar store: {}", std::strerror(errno))));
+        }
+
+        void* const mapping = mremap(mapping_, mapping_size_, size, MREMAP_MAYMOVE);
+        if (mapping == MAP_FAILED) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to remap columnar store: {}", std::strerror(errno))));
+        }
+
+        mapping_ = mapping;
+        mapping_size_ = size;
+        return {};
+    }
+
+    /// Unmaps and closes the file
+    auto release() -> void
+    {
+        if (mapping_ != nullptr) {
+            msync(mapping_, mapping_size_, MS_SYNC);
+            munmap(mapping_, mapping_size_);
+            mapping_ = nullptr;
+        }
+
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    std::filesystem::path file_;
+    int fd_{-1};
+    void* mapping_{nullptr};
+    std::size_t mapping_size_{0};
+    std::vector<IndexEntry> index_;
+    bool skipped_events_reported_{false};
+};
+
+} // namespace typetrace::backend
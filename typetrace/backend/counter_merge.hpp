@@ -0,0 +1,285 @@
+#pragma once
+
+#include "errors.hpp"
+#include "logger.hpp"
+#include "macros.hpp"
+#include "sql.hpp"
+
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Exception.h>
+#include <SQLiteCpp/Statement.h>
+#include <SQLiteCpp/Transaction.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <span>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Summary of a finished merge
+struct MergeStats
+{
+    std::size_t inputs{0};       ///< Number of merged database files
+    std::size_t rows_read{0};    ///< Number of per-origin rows read from all inputs
+    std::size_t rows_written{0}; ///< Number of per-origin rows in the output
+    std::size_t totals{0};       ///< Number of combined (date, scan_code) totals in the output
+};
+
+/// Merges keystroke databases of several machines into one
+///
+/// The counts of every machine are a grow-only counter per origin: the local `keystrokes` of a
+/// database belong to the origin in its metadata, previously merged rows keep their origin in
+/// `origin_counts`. For the same (date, scan_code, origin) the highest count wins, so merging any
+/// set of databases in any order and any number of times gives the same totals.
+///
+/// The merge is a streaming k-way sort-merge over (date, scan_code, origin): every input is read
+/// in index order and only the current row of each input is held in memory.
+///
+/// The output also gets a `keystrokes` table with the combined totals, so it can be read like the
+/// database of a single machine. Those totals are derived from `origin_counts` and are skipped when
+/// the output is merged again, which keeps them from being counted twice.
+class CounterMerge final
+{
+  public:
+    /// Merges the given database files into a new database file
+    ///
+    /// The merge is written to a temporary file next to the output and renamed on success, so a
+    /// failed merge leaves no output behind and can simply be retried.
+    [[nodiscard]]
+    static auto merge(std::span<const std::filesystem::path> inputs, const std::filesystem::path& output)
+      -> std::expected<MergeStats, Error>
+    {
+        auto& logger = common::Logger::instance();
+        logger.info("Merging {} databases into: {}", inputs.size(), output.string());
+
+        if (std::filesystem::exists(output)) {
+            return std::unexpected(make_environment_error("Merge output already exists, merge into a new file"));
+        }
+
+        auto temp_output = output;
+        temp_output += ".tmp";
+        remove_database(temp_output);
+
+        auto stats = write_merge(inputs, temp_output);
+        if (stats) {
+            std::error_code error;
+            std::filesystem::rename(temp_output, output, error);
+            if (error) {
+                stats = std::unexpected(make_system_error("Failed to move the merged database into place"));
+            }
+        }
+        if (!stats) {
+            remove_database(temp_output);
+            return stats;
+        }
+
+        logger.info("Merged {} rows from {} databases into {} rows and {} totals",
+                    stats->rows_read,
+                    stats->inputs,
+                    stats->rows_written,
+                    stats->totals);
+        return stats;
+    }
+
+  private:
+    /// Merges the given database files into the given new file
+    [[nodiscard]]
+    static auto write_merge(std::span<const std::filesystem::path> inputs, const std::filesystem::path& output)
+      -> std::expected<MergeStats, Error>
+    {
+        MergeStats stats{.inputs = inputs.size()};
+
+        try {
+            std::vector<std::unique_ptr<SQLite::Database>> databases;
+            std::vector<std::unique_ptr<Cursor>> cursors;
+
+            for (const auto& input : inputs) {
+                auto& database = databases.emplace_back(
+                  std::make_unique<SQLite::Database>(input.string(), static_cast<unsigned int>(SQLite::OPEN_READONLY)));
+                TRY(open_cursors(*database, input, cursors));
+            }
+
+            SQLite::Database out(output.string(),
+                                 static_cast<unsigned int>(SQLite::OPEN_READWRITE)
+                                   | static_cast<unsigned int>(SQLite::OPEN_CREATE));
+            out.exec(common::CREATE_ORIGIN_COUNTS_TABLE_SQL);
+
+            SQLite::Transaction transaction(out);
+            SQLite::Statement insert(out, common::INSERT_ORIGIN_COUNT_SQL);
+
+            // Min-heap of the cursors ordered by their current row
+            const auto greater = [](const Cursor* lhs, const Cursor* rhs) -> bool { return rhs->row < lhs->row; };
+            std::priority_queue<Cursor*, std::vector<Cursor*>, decltype(greater)> heap(greater);
+
+            for (const auto& cursor : cursors) {
+                if (cursor->advance()) {
+                    heap.push(cursor.get());
+                }
+            }
+
+            while (!heap.empty()) {
+                Row merged = heap.top()->row;
+
+                // Take the maximum over all inputs holding the same (date, scan_code, origin)
+                while (!heap.empty() && heap.top()->row.key() == merged.key()) {
+                    auto* cursor = heap.top();
+                    heap.pop();
+
+                    merged.count = std::max(merged.count, cursor->row.count);
+                    ++stats.rows_read;
+
+                    if (cursor->advance()) {
+                        heap.push(cursor);
+                    }
+                }
+
+                insert.bind(1, merged.date);
+                insert.bind(2, merged.scan_code);
+                insert.bind(3, merged.origin);
+                insert.bind(4, merged.key_name);
+                insert.bind(5, merged.count);
+                insert.exec();
+                insert.reset();
+
+                ++stats.rows_written;
+            }
+
+            out.exec(common::CREATE_KEYSTROKES_TABLE_SQL);
+            out.exec(common::CREATE_KEYSTROKES_DATE_INDEX_SQL);
+            stats.totals = static_cast<std::size_t>(out.exec(common::INSERT_MERGED_TOTALS_SQL));
+
+            transaction.commit();
+        }
+        catch (const SQLite::Exception& e) {
+            return std::unexpected(make_database_error(std::format("Failed to merge databases: {}", e.what())));
+        }
+
+        return stats;
+    }
+
+    /// Removes a database file and its rollback journal, if they exist
+    static auto remove_database(const std::filesystem::path& file) -> void
+    {
+        auto journal = file;
+        journal += "-journal";
+
+        std::error_code error;
+        std::filesystem::remove(file, error);
+        std::filesystem::remove(journal, error);
+    }
+
+    /// A per-origin count of a key on a day
+    struct Row
+    {
+        std::string date;
+        int scan_code{0};
+        std::string origin;
+        std::string key_name;
+        std::int64_t count{0};
+
+        [[nodiscard]]
+        auto key() const -> std::tuple<const std::string&, int, const std::string&>
+        {
+            return std::tie(date, scan_code, origin);
+        }
+
+        [[nodiscard]]
+        auto operator<(const Row& other) const -> bool
+        {
+            return key() < other.key();
+        }
+    };
+
+    /// Streams the rows of one table of an input in merge order
+    class Cursor
+    {
+      public:
+        /// Creates a cursor, rows of the local keystrokes table have no origin column and get the given one
+        Cursor(SQLite::Database& database, const char* query, std::optional<std::string> origin)
+            : stmt_(database, query),
+              origin_(std::move(origin))
+        {}
+
+        /// Moves to the next row, returns false once the table is exhausted
+        [[nodiscard]]
+        auto advance() -> bool
+        {
+            if (!stmt_.executeStep()) {
+                return false;
+            }
+
+            int column = 0;
+            row.date = stmt_.getColumn(column++).getString();
+            row.scan_code = stmt_.getColumn(column++).getInt();
+            row.origin = origin_ ? *origin_ : stmt_.getColumn(column++).getString();
+            row.key_name = stmt_.getColumn(column++).getString();
+            row.count = stmt_.getColumn(column).getInt64();
+
+            return true;
+        }
+
+        Row row;
+
+      private:
+        SQLite::Statement stmt_;
+        std::optional<std::string> origin_;
+    };
+
+    /// Opens the cursors over the local and the previously merged counts of an input
+    [[nodiscard]]
+    static auto open_cursors(SQLite::Database& database,
+                             const std::filesystem::path& input,
+                             std::vector<std::unique_ptr<Cursor>>& cursors) -> std::expected<void, Error>
+    {
+        const bool merged = has_table(database, "origin_counts");
+
+        // The keystrokes of a merge output are the totals of its origin_counts, not a local counter
+        if (!merged && has_table(database, "keystrokes")) {
+            std::optional<std::string> origin;
+            if (has_table(database, "metadata")) {
+                SQLite::Statement get_origin(database, common::GET_ORIGIN_SQL);
+                if (get_origin.executeStep()) {
+                    origin = get_origin.getColumn(0).getString();
+                }
+            }
+
+            if (!origin) {
+                common::Logger::instance().error("Database without origin: {}", input.string());
+                return std::unexpected(
+                  make_database_error("Database has no origin, open it once with the backend before merging"));
+            }
+
+            cursors.push_back(
+              std::make_unique<Cursor>(database, common::GET_LOCAL_COUNTS_IN_MERGE_ORDER_SQL, std::move(origin)));
+        }
+
+        if (merged) {
+            cursors.push_back(
+              std::make_unique<Cursor>(database, common::GET_ORIGIN_COUNTS_IN_MERGE_ORDER_SQL, std::nullopt));
+        }
+
+        return {};
+    }
+
+    /// Returns whether the database has a table with the given name
+    [[nodiscard]]
+    static auto has_table(SQLite::Database& database, const char* table) -> bool
+    {
+        SQLite::Statement stmt(database, common::HAS_TABLE_SQL);
+        stmt.bind(1, table);
+        return stmt.executeStep();
+    }
+};
+
+} // namespace typetrace::backend
@@ -1,99 +1,403 @@
 #pragma once
 
 #include "constants.hpp"
+#include "date.hpp"
 #include "errors.hpp"
 #include "logger.hpp"
 #include "macros.hpp"
+#include "origin.hpp"
+#include "partition_reader.hpp"
+#include "partitions.hpp"
 #include "sql.hpp"
+#include "storage_engine.hpp"
 #include "types.hpp"
 
 #include <SQLiteCpp/Database.h>
 #include <SQLiteCpp/Exception.h>
 #include <SQLiteCpp/Statement.h>
 #include <SQLiteCpp/Transaction.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <expected>
 #include <filesystem>
 #include <format>
+#include <functional>
+#include <future>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
 #include <vector>
 
 namespace typetrace::backend {
 
-class DatabaseManager final
+/// SQLite implementation of the storage engine
+///
+/// The data is partitioned into one database file per year. Only the partition of the
+/// current year is written to, older partitions are sealed: compacted and made read-only.
+/// Partitions left open by an earlier run are sealed on startup, the one left at the turn of
+/// the year on a background thread, so the vacuum never delays a write. Queries attach the
+/// partitions that overlap the requested range.
+class DatabaseManager final : public StorageEngine
 {
   public:
     /// Factory method to create a DatabaseManager instance
+    ///
+    /// A non-zero cache size (in KiB) overrides the page cache size of OPTIMIZE_DATABASE_SQL.
     [[nodiscard]]
-    static auto create(const std::filesystem::path& db_dir) -> std::expected<DatabaseManager, Error>
+    static auto create(const std::filesystem::path& db_dir, std::size_t cache_size_kib = 0)
+      -> std::expected<DatabaseManager, Error>
     {
         DatabaseManager manager;
-        manager.db_file_ = db_dir / DB_FILE_NAME;
+        manager.db_dir_ = db_dir;
+        manager.cache_size_kib_ = cache_size_kib;
 
         auto& logger = common::Logger::instance();
-        logger.info("Initializing database at: {}", manager.db_file_.string());
+        logger.info("Initializing database partitions in: {}", db_dir.string());
 
         try {
             if (!db_dir.empty() && !std::filesystem::exists(db_dir)) {
                 logger.debug("Creating parent directories for database path: {}", db_dir.string());
                 std::filesystem::create_directories(db_dir);
             }
+        }
+        catch (const std::filesystem::filesystem_error& e) {
+            return std::unexpected(make_system_error(std::format("Filesystem error: {}", e.what())));
+        }
+
+        const auto current_year = static_cast<int>(common::local_date().year());
+        TRY(manager.seal_partitions_before(current_year));
+        TRY(manager.open_partition(current_year));
+
+        return manager;
+    }
+
+    /// Writes a batch of buffered events to the partitions of their years
+    ///
+    /// Each year is written in a single transaction, so a failed write leaves its partition as it was.
+    /// The event handler passes one year per batch, which makes the retry of a failed batch safe. A
+    /// batch spanning several years would only be atomic per partition, since SQLite does not commit
+    /// attached WAL databases atomically.
+    [[nodiscard]]
+    auto write(const common::FlushBatch& batch) -> std::expected<void, Error> override
+    {
+        if (pending_seal_.valid() && pending_seal_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            finish_seal();
+        }
+
+        for (const auto year : batch_years(batch)) {
+            TRY(open_partition(year));
+
+            try {
+                SQLite::Transaction transaction(*db_);
+
+                auto written = write_events(batch.keystrokes,
+                                            year,
+                                            common::UPSERT_KEYSTROKE_SQL,
+                                            [](SQLite::Statement& stmt, const common::KeystrokeEvent& event) -> void {
+                                                stmt.bind(1, static_cast<int>(event.key_code));
+                                                stmt.bind(2, event.key_name.data());
+                                                stmt.bind(3, common::format_date(event.date));
+                                                stmt.bind(4, event.count);
+                                            });
+
+                written += write_events(batch.characters,
+                                        year,
+                                        common::UPSERT_CHARACTER_SQL,
+                                        [](SQLite::Statement& stmt, const common::CharacterEvent& event) -> void {
+                                            stmt.bind(1, event.character.data());
+                                            stmt.bind(2, common::format_date(event.date));
+                                            stmt.bind(3, event.count);
+                                        });
+
+                written += write_events(batch.chords,
+                                        year,
+                                        common::UPSERT_CHORD_SQL,
+                                        [](SQLite::Statement& stmt, const common::ChordEvent& event) -> void {
+                                            stmt.bind(1, static_cast<int>(event.modifiers));
+                                            stmt.bind(2, static_cast<int>(event.key_code));
+                                            stmt.bind(3, common::format_date(event.date));
+                                            stmt.bind(4, event.count);
+                                        });
+
+                written += write_events(
+                  batch.sessions,
+                  year,
+                  common::INSERT_SESSION_SQL,
+                  [](SQLite::Statement& stmt, const common::TypingSession& session) -> void {
+                      stmt.bind(1, common::format_date(session.date));
+                      stmt.bind(2, static_cast<std::int64_t>(session.start.time_since_epoch().count()));
+                      stmt.bind(3, static_cast<std::int64_t>(session.end.time_since_epoch().count()));
+                      stmt.bind(4, session.key_count);
+                      stmt.bind(5, session.peak_keys_per_minute);
+                  });
+
+                transaction.commit();
+
+                common::Logger::instance().debug(
+                  "Inserted {} events into the database: {}", written, db_file_.string());
+            }
+            catch (const SQLite::Exception& e) {
+                return std::unexpected(make_database_error(std::format("Failed to write to database: {}", e.what())));
+            }
+        }
+
+        return {};
+    }
+
+    /// Returns the total amount of key presses per day between two dates (inclusive)
+    [[nodiscard]]
+    auto daily_counts(std::chrono::year_month_day from, std::chrono::year_month_day to)
+      -> std::expected<std::vector<common::DailyCount>, Error> override
+    {
+        return common::PartitionReader::daily_counts(db_dir_, from, to);
+    }
+
+    /// Returns the name of the storage engine
+    [[nodiscard]]
+    auto name() const -> std::string_view override
+    {
+        return "sqlite";
+    }
+
+    /// Returns the directory holding the partitions
+    [[nodiscard]]
+    auto directory() const -> const std::filesystem::path&
+    {
+        return db_dir_;
+    }
+
+    /// Returns the file of the partition currently written to
+    [[nodiscard]]
+    auto active_partition() const -> const std::filesystem::path&
+    {
+        return db_file_;
+    }
+
+    /// Returns the connection to the partition currently written to, null after it failed to open
+    [[nodiscard]]
+    auto connection() -> SQLite::Database*
+    {
+        return db_.get();
+    }
+
+    /// Sets a function called before the connection returned by connection() is closed or replaced
+    ///
+    /// Anything still using the connection, e.g. an online backup, has to let go of it in the hook,
+    /// otherwise closing it fails with SQLITE_BUSY.
+    auto set_close_hook(std::function<void()> hook) -> void
+    {
+        close_hook_ = std::move(hook);
+    }
+
+  private:
+    /// Private constructor - use create() factory method
+    DatabaseManager() = default;
+
+    /// Returns whether a partition file has been sealed
+    [[nodiscard]]
+    static auto is_sealed(const std::filesystem::path& file) -> bool
+    {
+        const auto perms = std::filesystem::status(file).permissions();
+        return (perms & std::filesystem::perms::owner_write) == std::filesystem::perms::none;
+    }
+
+    /// Makes the partition of the given year the one written to
+    [[nodiscard]]
+    auto open_partition(int year) -> std::expected<void, Error>
+    {
+        if (db_ != nullptr && year == partition_year_) {
+            return {};
+        }
+
+        auto& logger = common::Logger::instance();
 
-            manager.db_ = std::make_unique<SQLite::Database>(manager.db_file_.string(),
-                                                             static_cast<unsigned int>(SQLite::OPEN_READWRITE)
-                                                               | static_cast<unsigned int>(SQLite::OPEN_CREATE));
+        // Leaving a partition of a past year means it will not be written to anymore
+        const bool seal = db_ != nullptr && partition_year_ < static_cast<int>(common::local_date().year());
+        close_connection();
+        if (seal) {
+            start_seal(db_file_);
+        }
+
+        partition_year_ = year;
+        db_file_ = common::partition_file(db_dir_, year);
+        logger.info("Opening database partition: {}", db_file_.string());
+
+        // Late events for the partition being sealed have to wait for the seal to finish
+        if (db_file_ == sealing_file_) {
+            finish_seal();
+        }
+
+        try {
+            if (std::filesystem::exists(db_file_) && is_sealed(db_file_)) {
+                // Late events for a past year, e.g. after the clock was turned back
+                logger.warn("Reopening sealed database partition: {}", db_file_.string());
+                std::filesystem::permissions(
+                  db_file_, std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+            }
+
+            db_ = std::make_unique<SQLite::Database>(db_file_.string(),
+                                                     static_cast<unsigned int>(SQLite::OPEN_READWRITE)
+                                                       | static_cast<unsigned int>(SQLite::OPEN_CREATE));
 
             // WAL mode
-            manager.db_->exec(common::OPTIMIZE_DATABASE_SQL);
-            TRY(manager.create_tables());
+            db_->exec(common::OPTIMIZE_DATABASE_SQL);
+            if (cache_size_kib_ != 0) {
+                db_->exec(std::format(common::SET_CACHE_SIZE_SQL, cache_size_kib_));
+            }
+            TRY(create_tables());
             logger.info("Database tables created successfully");
         }
         catch (const SQLite::Exception& e) {
-            return std::unexpected(make_database_error(
-              std::format("Failed to open database '{}': {}", manager.db_file_.string(), e.what())));
+            close_connection();
+            return std::unexpected(
+              make_database_error(std::format("Failed to open database '{}': {}", db_file_.string(), e.what())));
         }
         catch (const std::filesystem::filesystem_error& e) {
+            close_connection();
             return std::unexpected(make_system_error(std::format("Filesystem error: {}", e.what())));
         }
 
-        return manager;
+        return {};
     }
 
-    /// Writes a buffer of keystroke events to the database
+    /// Compacts a closed partition file and makes it read-only
     [[nodiscard]]
-    auto write_to_database(const std::vector<common::KeystrokeEvent>& buffer) -> std::expected<void, Error>
+    static auto seal_file(const std::filesystem::path& file) -> std::expected<void, Error>
     {
-        if (buffer.empty()) {
-            return {};
-        }
+        common::Logger::instance().info("Sealing database partition: {}", file.string());
 
         try {
-            SQLite::Transaction transaction(*db_);
-            SQLite::Statement stmt(*db_, common::UPSERT_KEYSTROKE_SQL);
+            {
+                SQLite::Database db(file.string(), static_cast<unsigned int>(SQLite::OPEN_READWRITE));
+                db.exec(common::SEAL_PARTITION_SQL);
+            }
+
+            std::filesystem::permissions(file,
+                                         std::filesystem::perms::owner_write | std::filesystem::perms::group_write
+                                           | std::filesystem::perms::others_write,
+                                         std::filesystem::perm_options::remove);
+        }
+        catch (const SQLite::Exception& e) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to seal partition '{}': {}", file.string(), e.what())));
+        }
+        catch (const std::filesystem::filesystem_error& e) {
+            return std::unexpected(make_system_error(std::format("Filesystem error: {}", e.what())));
+        }
 
-            for (const auto& event : buffer) {
-                stmt.bind(1, static_cast<int>(event.key_code));
-                stmt.bind(2, event.key_name.data());
-                stmt.bind(3, event.date.data());
+        return {};
+    }
 
-                stmt.exec();
-                stmt.reset();
-            }
+    /// Seals a closed partition file on a background thread, after any seal still running
+    auto start_seal(const std::filesystem::path& file) -> void
+    {
+        finish_seal();
 
-            transaction.commit();
+        sealing_file_ = file;
+        pending_seal_ =
+          std::async(std::launch::async, [file] -> std::expected<void, Error> { return seal_file(file); });
+    }
 
-            common::Logger::instance().debug(
-              "Inserted {} keystrokes into the database: {}", buffer.size(), db_file_.string());
+    /// Waits for the background seal, a failed seal is retried on the next startup
+    auto finish_seal() -> void
+    {
+        if (!pending_seal_.valid()) {
+            return;
         }
-        catch (const SQLite::Exception& e) {
-            return std::unexpected(make_database_error(std::format("Failed to write to database: {}", e.what())));
+
+        if (const auto result = pending_seal_.get(); !result) {
+            common::Logger::instance().warn("{}, sealing it again on the next start", result.error().message);
+        }
+        sealing_file_.clear();
+    }
+
+    /// Closes the connection to the active partition, after telling the close hook
+    auto close_connection() -> void
+    {
+        if (db_ != nullptr && close_hook_) {
+            close_hook_();
+        }
+        db_.reset();
+    }
+
+    /// Seals all partitions before the given year that were left open, e.g. when the backend
+    /// was not running at the turn of the year
+    [[nodiscard]]
+    auto seal_partitions_before(int year) -> std::expected<void, Error>
+    {
+        try {
+            for (const auto& entry : std::filesystem::directory_iterator(db_dir_)) {
+                const auto entry_year = common::partition_year(entry.path());
+                if (!entry_year || *entry_year >= year || is_sealed(entry.path())) {
+                    continue;
+                }
+
+                TRY(seal_file(entry.path()));
+            }
+        }
+        catch (const std::filesystem::filesystem_error& e) {
+            return std::unexpected(make_system_error(std::format("Filesystem error: {}", e.what())));
         }
 
         return {};
     }
 
-  private:
-    /// Private constructor - use create() factory method
-    DatabaseManager() = default;
+    /// Returns the distinct years of the events in a batch in ascending order
+    [[nodiscard]]
+    static auto batch_years(const common::FlushBatch& batch) -> std::vector<int>
+    {
+        std::vector<int> years;
+        const auto add_years = [&years](const auto& events) -> void {
+            for (const auto& event : events) {
+                const auto year = static_cast<int>(event.date.year());
+                if (std::ranges::find(years, year) == years.end()) {
+                    years.push_back(year);
+                }
+            }
+        };
+
+        add_years(batch.keystrokes);
+        add_years(batch.characters);
+        add_years(batch.chords);
+        add_years(batch.sessions);
+
+        std::ranges::sort(years);
+        return years;
+    }
+
+    /// Writes the events of a year to the open partition, binding each event with the given function
+    ///
+    /// Runs inside the transaction of the caller and returns the number of written events.
+    template<typename Event, typename Bind>
+    auto write_events(std::span<const Event> events, int year, const char* sql, Bind bind) -> std::size_t
+    {
+        std::optional<SQLite::Statement> stmt;
+        std::size_t written = 0;
+
+        for (const auto& event : events) {
+            if (static_cast<int>(event.date.year()) != year) {
+                continue;
+            }
+
+            // Most batches lack some kinds of events, so statements are only prepared when needed
+            if (!stmt) {
+                stmt.emplace(*db_, sql);
+            }
+
+            bind(*stmt, event);
+            stmt->exec();
+            stmt->reset();
+            ++written;
+        }
+
+        return written;
+    }
 
     /// Creates necessary database tables if they don't exist
     [[nodiscard]]
@@ -101,6 +405,16 @@ class DatabaseManager final
     {
         try {
             db_->exec(common::CREATE_KEYSTROKES_TABLE_SQL);
+            db_->exec(common::CREATE_KEYSTROKES_DATE_INDEX_SQL);
+            db_->exec(common::CREATE_CHARACTERS_TABLE_SQL);
+            db_->exec(common::CREATE_CHORDS_TABLE_SQL);
+            db_->exec(common::CREATE_SESSIONS_TABLE_SQL);
+            db_->exec(common::CREATE_SESSIONS_DATE_INDEX_SQL);
+            db_->exec(common::CREATE_METADATA_TABLE_SQL);
+
+            SQLite::Statement set_origin(*db_, common::SET_ORIGIN_SQL);
+            set_origin.bind(1, local_origin());
+            set_origin.exec();
         }
         catch (const SQLite::Exception& e) {
             return std::unexpected(make_database_error(std::format("Failed to create tables: {}", e.what())));
@@ -108,8 +422,14 @@ class DatabaseManager final
         return {};
     }
 
+    std::filesystem::path db_dir_;
     std::filesystem::path db_file_;
+    int partition_year_{0};
+    std::size_t cache_size_kib_{0};
     std::unique_ptr<SQLite::Database> db_;
+    std::function<void()> close_hook_;
+    std::filesystem::path sealing_file_;
+    std::future<std::expected<void, Error>> pending_seal_; ///< Waited for on destruction
 };
 
 } // namespace typetrace::backend
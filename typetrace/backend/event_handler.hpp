@@ -1,21 +1,33 @@
 #pragma once
 
+#include "chord_counter.hpp"
+#include "clock.hpp"
 #include "constants.hpp"
 #include "errors.hpp"
+#include "keymap_cache.hpp"
 #include "logger.hpp"
 #include "macros.hpp"
+#include "memory_budget.hpp"
+#include "modifier_state.hpp"
+#include "session_tracker.hpp"
+#include "startup_trace.hpp"
+#include "time_source.hpp"
 #include "types.hpp"
 
 #include <algorithm>
 #include <cerrno>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <expected>
 #include <fcntl.h>
 #include <format>
 #include <functional>
+#include <future>
 #include <grp.h>
 #include <iostream>
+#include <iterator>
 #include <libevdev-1.0/libevdev/libevdev.h>
 #include <libinput.h>
 #include <libudev.h>
@@ -24,67 +36,207 @@
 #include <optional>
 #include <poll.h>
 #include <print>
+#include <span>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
 namespace typetrace::backend {
 
-using Clock = std::chrono::steady_clock;
-
 class EventHandler
 {
   public:
+    /// Writes a batch to the storage, a failed write keeps the batch buffered for a retry
+    using BufferCallback = std::function<std::expected<void, Error>(const common::FlushBatch&)>;
+
     /// Factory method to create an EventHandler instance
     [[nodiscard]]
-    static auto create() -> std::expected<EventHandler, Error>
+    static auto create(common::StartupTrace& startup_trace) -> std::expected<EventHandler, Error>
     {
         EventHandler handler;
 
-        TRY(handler.check_input_group_membership());
-        TRY(handler.initialize_libinput());
-        TRY(handler.check_device_accessibility());
+        // The group lookup may go through NSS, so run it while udev and libinput are set up
+        auto group_check = std::async(std::launch::async, [&startup_trace] -> std::expected<void, Error> {
+            return startup_trace.measure("input group check", check_input_group_membership);
+        });
+
+        TRY(startup_trace.measure("libinput initialization", [&handler] { return handler.initialize_libinput(); }));
+        TRY(group_check.get());
+        TRY(startup_trace.measure("device accessibility check",
+                                  [&handler] { return handler.check_device_accessibility(); }));
 
+        handler.last_flush_time_ = handler.time_.now();
+        return handler;
+    }
+
+    /// Creates an EventHandler without input devices, key events are passed to process_key() instead
+    ///
+    /// Used by the simulation, which also replaces the clocks with simulated ones.
+    [[nodiscard]]
+    static auto create_detached(TimeSource time_source) -> EventHandler
+    {
+        EventHandler handler;
+        handler.time_ = std::move(time_source);
+        handler.last_flush_time_ = handler.time_.now();
         return handler;
     }
 
     /// Sets the callback function to be called when the buffer needs to be flushed
-    auto set_buffer_callback(std::function<void(const std::vector<common::KeystrokeEvent>&)> callback) -> void
+    auto set_buffer_callback(BufferCallback callback) -> void
     {
         buffer_callback_ = std::move(callback);
     }
 
-    /// Traces keyboard events and processes them into keystroke events
-    auto trace() -> void
+    /// Sets a function called with the scan code of every key press, e.g. for live statistics
+    auto set_keystroke_observer(std::function<void(std::uint32_t)> observer) -> void
     {
-        struct pollfd pfd = {
-          .fd = libinput_get_fd(li_.get()),
-          .events = POLLIN,
-          .revents = 0,
-        };
+        keystroke_observer_ = std::move(observer);
+    }
+
+    /// Takes the role of the right Alt key from the keymap, chords are counted as Alt or AltGr
+    auto apply_keymap_modifiers(const KeymapCache& keymap) -> void
+    {
+        modifiers_.set_right_alt_is_altgr(keymap.right_alt_is_altgr());
+    }
 
-        const int result = poll(&pfd, 1, POLL_TIMEOUT_MS);
+    /// Enables counting the characters typed with the keymap, in addition to the scan codes
+    auto enable_character_tracking(KeymapCache keymap) -> void
+    {
+        apply_keymap_modifiers(keymap);
+        keymap_ = std::move(keymap);
+    }
 
-        if (result < 0) {
-            common::Logger::instance().error("Poll failed with error: {}", std::strerror(errno));
-            return;
+    /// Limits every event queue to a fixed capacity
+    ///
+    /// A full queue is coalesced where its events allow it, and otherwise flushed ahead of the
+    /// flush threshold. Events are never dropped: while no storage accepts them, the queue grows
+    /// past its capacity.
+    auto set_buffer_capacity(std::size_t capacity) -> void
+    {
+        buffer_capacity_ = capacity;
+        buffer_.reserve(capacity);
+        if (keymap_) {
+            characters_.reserve(capacity);
+        }
+        sessions_.reserve(capacity);
+        chord_counter_.set_capacity(capacity);
+    }
+
+    /// Returns the memory reserved by the event queues and the lookup tables
+    [[nodiscard]]
+    auto memory() const -> HandlerMemory
+    {
+        return {.buffer_bytes = (buffer_.capacity() * sizeof(common::KeystrokeEvent))
+                              + (characters_.capacity() * sizeof(common::CharacterEvent))
+                              + (sessions_.capacity() * sizeof(common::TypingSession)) + chord_counter_.event_bytes(),
+                .chord_table_bytes = chord_counter_.table_bytes(),
+                .keymap_bytes = keymap_ ? keymap_->bytes() : 0};
+    }
+
+    /// Returns the number of buffered events not yet written to the storage
+    [[nodiscard]]
+    auto buffered_events() const -> std::size_t
+    {
+        return buffer_.size() + characters_.size() + sessions_.size();
+    }
+
+    /// Returns how often the buffer has been flushed
+    [[nodiscard]]
+    auto flush_count() const -> std::size_t
+    {
+        return flush_count_;
+    }
+
+    /// Writes the buffered events to the storage right away, returns whether nothing is left buffered
+    ///
+    /// Fails while no storage is attached yet or when the storage rejects the write.
+    auto flush() -> bool
+    {
+        common::Logger::instance().debug("Flushing buffer: requested");
+        flush_buffer();
+        return buffer_callback_ && buffered_events() == 0;
+    }
+
+    /// Closes the open typing session and writes everything buffered, used at shutdown
+    auto finish() -> void
+    {
+        if (auto session = session_tracker_.close()) {
+            finish_session(*session);
+        }
+        if (!flush()) {
+            common::Logger::instance().error("Shutting down with {} events not written", buffered_events());
         }
+    }
 
-        if (result > 0 && ((POLLIN & pfd.revents) != 0)) {
+    /// Returns the libinput file descriptor, to be polled for POLLIN by the event loop
+    [[nodiscard]]
+    auto fd() const -> int
+    {
+        return libinput_get_fd(li_.get());
+    }
+
+    /// Processes the keyboard events when the polled file descriptor is readable, then flushes when due
+    auto trace(short revents) -> void
+    {
+        if ((POLLIN & revents) != 0) {
             libinput_dispatch(li_.get());
 
             // Process all available events
             struct libinput_event* event = nullptr;
             while ((event = libinput_get_event(li_.get())) != nullptr) {
                 if (libinput_event_get_type(event) == LIBINPUT_EVENT_KEYBOARD_KEY) {
-                    if (const auto keystroke = process_keyboard_event(event)) {
-                        buffer_.push_back(*keystroke);
-                    }
+                    process_keyboard_event(event);
                 }
 
                 libinput_event_destroy(event);
             }
         }
 
+        tick();
+    }
+
+    /// Processes a key press or release at the given monotonic time into the buffers
+    auto process_key(std::uint32_t key_code, bool pressed, Clock::time_point time) -> void
+    {
+        // Modifiers need their releases as well, everything else only processes key presses
+        modifiers_.update(key_code, pressed);
+        if (!pressed) {
+            return;
+        }
+
+        if (auto session = session_tracker_.record(time, time_)) {
+            finish_session(*session);
+        }
+
+        const auto date = time_.today();
+        chord_counter_.record(modifiers_.mask(), key_code, date);
+        make_room([this] -> std::size_t { return chord_counter_.pending_events(); });
+
+        if (keymap_) {
+            if (const auto character = keymap_->character(key_code, modifiers_.mask())) {
+                buffer_character({.character = *character, .date = date, .count = 1});
+            }
+        }
+
+        const auto* key_name_str = libevdev_event_code_get_name(EV_KEY, static_cast<unsigned int>(key_code));
+        const auto key_name = key_name_str != nullptr ? std::string_view(key_name_str) : std::string_view("UNKNOWN");
+
+        common::Logger::instance().debug(
+          "Added keystroke [{}/{}] to buffer: {} (code: {})", buffer_.size() + 1, BUFFER_SIZE, key_name, key_code);
+        buffer_keystroke({.key_name = key_name, .date = date, .key_code = key_code, .count = 1});
+
+        if (keystroke_observer_) {
+            keystroke_observer_(key_code);
+        }
+    }
+
+    /// Closes idle typing sessions and flushes the buffer when it is due, called after every poll
+    auto tick() -> void
+    {
+        if (auto session = session_tracker_.expire(time_.now())) {
+            finish_session(*session);
+        }
+
         if (should_flush()) {
             flush_buffer();
         }
@@ -194,55 +346,151 @@ Then log out and log back in for the changes to take effect.
         return {};
     }
 
-    /// Processes a libinput keyboard event into a keystroke event
-    [[nodiscard]]
-    auto process_keyboard_event(struct libinput_event* event) -> std::optional<common::KeystrokeEvent>
+    /// Processes a libinput keyboard event
+    auto process_keyboard_event(struct libinput_event* event) -> void
     {
-        cauto& logger = common::Logger::instance();
-
         auto* keyboard_event = libinput_event_get_keyboard_event(event);
         if (keyboard_event == nullptr) {
-            logger.warn("Failed to get keyboard event from libinput event");
-            return std::nullopt;
+            common::Logger::instance().warn("Failed to get keyboard event from libinput event");
+            return;
         }
 
-        // Ignore releases, only process key presses
-        if (libinput_event_keyboard_get_key_state(keyboard_event) != LIBINPUT_KEY_STATE_PRESSED) {
-            return std::nullopt;
+        // Event times are CLOCK_MONOTONIC, the clock of the steady clock
+        const Clock::time_point time{
+          std::chrono::microseconds(static_cast<std::int64_t>(libinput_event_keyboard_get_time_usec(keyboard_event)))};
+
+        process_key(libinput_event_keyboard_get_key(keyboard_event),
+                    libinput_event_keyboard_get_key_state(keyboard_event) == LIBINPUT_KEY_STATE_PRESSED,
+                    time);
+    }
+
+    /// Adds a keystroke to the buffer
+    auto buffer_keystroke(const common::KeystrokeEvent& keystroke) -> void
+    {
+        buffer_event(buffer_, keystroke, keystroke_key);
+    }
+
+    /// Adds a typed character to the character buffer
+    auto buffer_character(const common::CharacterEvent& character) -> void
+    {
+        buffer_event(characters_, character, character_key);
+    }
+
+    /// Appends an event to a buffer, coalescing or flushing the buffer first if it is full
+    template<typename Event, typename Key>
+    auto buffer_event(std::vector<Event>& buffer, const Event& event, Key key) -> void
+    {
+        if (is_full(buffer.size())) {
+            coalesce_buffer(buffer, key);
         }
+        make_room([&buffer] -> std::size_t { return buffer.size(); });
 
-        const auto key_code = libinput_event_keyboard_get_key(keyboard_event);
-        const auto* key_name_str = libevdev_event_code_get_name(EV_KEY, static_cast<unsigned int>(key_code));
-        const auto key_name = key_name_str != nullptr ? std::string_view(key_name_str) : std::string_view("UNKNOWN");
-        // const auto time_now = std::chrono::system_clock::now();
+        buffer.push_back(event);
+    }
+
+    /// Returns whether a queue of the given size has reached the capacity
+    [[nodiscard]]
+    auto is_full(std::size_t size) const -> bool
+    {
+        return buffer_capacity_ != 0 && size >= buffer_capacity_;
+    }
+
+    /// Flushes ahead of the flush threshold if the queue with the given size is full
+    ///
+    /// Without a storage, or while a failed storage waits for its retry, the queue keeps growing
+    /// past its capacity instead of losing key presses. That is logged once until a flush succeeds.
+    template<typename Size>
+    auto make_room(Size size) -> void
+    {
+        if (!is_full(size())) {
+            return;
+        }
+
+        const bool retry_due = !write_failed_ || time_.now() - last_flush_time_ >= std::chrono::seconds(BUFFER_TIMEOUT);
+        if (buffer_callback_ && retry_due) {
+            common::Logger::instance().debug("Flushing buffer: a queue reached its capacity of {} events",
+                                             buffer_capacity_);
+            flush_buffer();
+        }
+
+        if (is_full(size()) && !over_capacity_) {
+            over_capacity_ = true;
+            common::Logger::instance().warn(
+              "Event queue is over its capacity of {} events, keeping them until the storage accepts them",
+              buffer_capacity_);
+        }
+    }
+
+    /// Merges buffered events with the same key into a single entry with their total count
+    ///
+    /// The key starts with the day number, so the buffer stays chronological.
+    template<typename Event, typename Key>
+    static auto coalesce_buffer(std::vector<Event>& buffer, Key key) -> void
+    {
+        const auto size_before = buffer.size();
+
+        std::ranges::sort(buffer, {}, key);
 
-        common::KeystrokeEvent keystroke{.key_name = key_name,
-                                         .date = "FIX_ME", // std::format("{:%Y-%m-%d}",
-                                         .key_code = key_code,
-                                         // std::chrono::time_point_cast<std::chrono::days>(time_now)),
-                                         .count = 1};
+        // Only called on a full buffer, so it is never empty
+        auto merged = buffer.begin();
+        for (auto current = std::next(merged); current != buffer.end(); ++current) {
+            if (key(*current) == key(*merged)) {
+                merged->count += current->count;
+            } else {
+                *++merged = *current;
+            }
+        }
+        buffer.erase(std::next(merged), buffer.end());
 
-        logger.debug("Added keystroke [{}/{}] to buffer: {} (code: {})",
-                     buffer_.size() + 1,
-                     BUFFER_SIZE,
-                     keystroke.key_name.data(),
-                     key_code);
+        common::Logger::instance().debug("Coalesced buffer from {} to {} entries", size_before, buffer.size());
+    }
 
-        return keystroke;
+    /// Coalescing key of a keystroke: its day and scan code
+    [[nodiscard]]
+    static auto keystroke_key(const common::KeystrokeEvent& event) -> std::pair<std::int32_t, std::uint32_t>
+    {
+        return {common::to_day_number(event.date), event.key_code};
+    }
+
+    /// Coalescing key of a typed character: its day and UTF-8 sequence
+    [[nodiscard]]
+    static auto character_key(const common::CharacterEvent& event) -> std::pair<std::int32_t, common::Character>
+    {
+        return {common::to_day_number(event.date), event.character};
+    }
+
+    /// Buffers a typing session closed by the session tracker
+    auto finish_session(const common::TypingSession& session) -> void
+    {
+        common::Logger::instance().debug("Typing session ended: {} keys in {}s, peak {} keys/min",
+                                         session.key_count,
+                                         (session.end - session.start).count(),
+                                         session.peak_keys_per_minute);
+        make_room([this] -> std::size_t { return sessions_.size(); });
+        sessions_.push_back(session);
     }
 
     /// Determines if the buffer should be flushed based on size and time
     [[nodiscard]]
     auto should_flush() const -> bool
     {
+        // Keep buffering until a sink is attached, e.g. while the database is still opening
+        if (!buffer_callback_) {
+            return false;
+        }
+
+        // After a failed write the storage gets the full timeout to recover before the next attempt
+        const auto elapsed_duration = time_.now() - last_flush_time_;
+        if (write_failed_) {
+            return elapsed_duration >= std::chrono::seconds(BUFFER_TIMEOUT);
+        }
+
         if (buffer_.size() >= BUFFER_SIZE) {
             common::Logger::instance().debug("Flushing buffer: size threshold reached ({} events)", buffer_.size());
             return true;
         }
 
-        if (!buffer_.empty()) {
-            const auto elapsed_duration = Clock::now() - last_flush_time_;
-
+        if (!buffer_.empty() || !sessions_.empty()) {
             if (elapsed_duration >= std::chrono::seconds(BUFFER_TIMEOUT)) {
                 common::Logger::instance().debug("Flushing buffer: time threshold reached ({}s elapsed)",
                                                  BUFFER_TIMEOUT);
@@ -253,30 +501,107 @@ Then log out and log back in for the changes to take effect.
         return false;
     }
 
-    /// Flushes the current buffer by calling the buffer callback
+    /// Flushes the current buffer by calling the buffer callback once per year
+    ///
+    /// Each call passes the leading events of a single year, which a storage writes to one partition in
+    /// one transaction. The events of a year are dropped as soon as they are written, so when a later
+    /// year fails, the retry does not count the earlier years twice.
     auto flush_buffer() -> void
     {
-        if (buffer_.empty()) {
+        if ((buffer_.empty() && sessions_.empty()) || !buffer_callback_) {
             return;
         }
 
-        if (buffer_callback_) {
-            const auto elapsed_seconds =
-              std::chrono::duration_cast<std::chrono::duration<double>>(Clock::now() - last_flush_time_).count();
-            common::Logger::instance().debug(
-              "Flushing buffer with {} events in {:.2f}s to database", buffer_.size(), elapsed_seconds);
+        const auto elapsed_seconds =
+          std::chrono::duration_cast<std::chrono::duration<double>>(time_.now() - last_flush_time_).count();
+        common::Logger::instance().debug(
+          "Flushing buffer with {} events in {:.2f}s to database", buffer_.size(), elapsed_seconds);
+
+        chord_counter_.drain();
+        while (const auto year = oldest_buffered_year()) {
+            const common::FlushBatch batch{
+              .keystrokes = leading_events<common::KeystrokeEvent>(buffer_, *year),
+              .characters = leading_events<common::CharacterEvent>(characters_, *year),
+              .chords = leading_events(chord_counter_.events(), *year),
+              .sessions = leading_events<common::TypingSession>(sessions_, *year),
+            };
+
+            const auto result = buffer_callback_(batch);
+            last_flush_time_ = time_.now();
+
+            // The events stay buffered, so the retry writes them together with the ones pressed meanwhile
+            write_failed_ = !result;
+            if (!result) {
+                common::Logger::instance().error("Failed to write to storage, keeping {} events buffered: {}",
+                                                 buffered_events(),
+                                                 result.error().message);
+                return;
+            }
 
-            buffer_callback_(buffer_);
+            drop_leading(buffer_, batch.keystrokes.size());
+            drop_leading(characters_, batch.characters.size());
+            chord_counter_.drop_events(batch.chords.size());
+            drop_leading(sessions_, batch.sessions.size());
         }
+        ++flush_count_;
+        over_capacity_ = false;
+    }
+
+    /// Returns the year of the oldest event at the front of the buffers, if any event is buffered
+    [[nodiscard]]
+    auto oldest_buffered_year() const -> std::optional<std::chrono::year>
+    {
+        std::optional<std::chrono::year> year;
+        const auto consider = [&year](const auto& events) -> void {
+            if (!events.empty() && (!year || events.front().date.year() < *year)) {
+                year = events.front().date.year();
+            }
+        };
+
+        consider(buffer_);
+        consider(characters_);
+        consider(chord_counter_.events());
+        consider(sessions_);
+        return year;
+    }
+
+    /// Returns the run of events at the front of a buffer that belong to the given year
+    ///
+    /// The buffers are chronological, so this is every buffered event of the oldest year.
+    template<typename Event>
+    [[nodiscard]]
+    static auto leading_events(std::span<const Event> events, std::chrono::year year) -> std::span<const Event>
+    {
+        const auto end =
+          std::ranges::find_if(events, [year](const Event& event) -> bool { return event.date.year() != year; });
+        return events.first(static_cast<std::size_t>(end - events.begin()));
+    }
 
-        buffer_.clear();
-        last_flush_time_ = Clock::now();
+    /// Removes the given number of written events from the front of a buffer
+    template<typename Event>
+    static auto drop_leading(std::vector<Event>& events, std::size_t count) -> void
+    {
+        events.erase(events.begin(), std::next(events.begin(), static_cast<std::ptrdiff_t>(count)));
     }
 
     std::vector<common::KeystrokeEvent> buffer_;
+    std::vector<common::CharacterEvent> characters_;
+    std::vector<common::TypingSession> sessions_;
+    std::size_t buffer_capacity_{0}; ///< Zero means unbounded
+    bool over_capacity_{false};      ///< A queue outgrew its capacity since the last successful flush
     Clock::time_point last_flush_time_;
+    bool write_failed_{false}; ///< The last flush failed and its events are still buffered
+    TimeSource time_;
+
+    ModifierState modifiers_;
+    SessionTracker session_tracker_;
+    ChordCounter chord_counter_;
+    std::optional<KeymapCache> keymap_; ///< Only set when character tracking is enabled
+
+    std::size_t flush_count_{0};
 
-    std::function<void(const std::vector<common::KeystrokeEvent>&)> buffer_callback_;
+    BufferCallback buffer_callback_;
+    std::function<void(std::uint32_t)> keystroke_observer_;
 
     std::unique_ptr<struct libinput, decltype(&libinput_unref)> li_{nullptr, &libinput_unref};
     std::unique_ptr<struct udev, decltype(&udev_unref)> udev_{nullptr, &udev_unref};
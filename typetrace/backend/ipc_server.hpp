@@ -0,0 +1,435 @@
+#pragma once
+
+#include "clock.hpp"
+#include "constants.hpp"
+#include "errors.hpp"
+#include "ipc.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <linux/input-event-codes.h>
+#include <optional>
+#include <poll.h>
+#include <span>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Serves the IPC protocol of common/ipc.hpp on a Unix domain socket
+///
+/// The server never blocks: its sockets are polled together with the input devices by the
+/// event loop, which passes the results to handle_events(). Key presses are counted per key
+/// between two live updates, so subscribers receive one coalesced delta per
+/// IPC_UPDATE_INTERVAL_MS at most.
+class IpcServer final
+{
+  public:
+    /// State of the event buffer reported by STATS, the server counts uptime and key presses itself
+    struct BufferStats
+    {
+        std::uint64_t buffered_events{0}; ///< Not yet written to the storage
+        std::uint64_t flushes{0};
+    };
+
+    /// Callbacks that carry out the requests
+    struct Handlers
+    {
+        std::function<bool()> flush; ///< Returns whether everything buffered was written
+        std::function<BufferStats()> buffer_stats;
+        std::function<void(const common::ipc::ConfigMessage&)> reload_config;
+        std::function<void()> stop;
+    };
+
+    /// Factory method to create an IpcServer listening on the given socket path
+    [[nodiscard]]
+    static auto create(const std::filesystem::path& socket_path, Handlers handlers) -> std::expected<IpcServer, Error>
+    {
+        auto& logger = common::Logger::instance();
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        const auto path = socket_path.string();
+        if (path.size() >= sizeof(address.sun_path)) {
+            return std::unexpected(make_environment_error("IPC socket path is too long"));
+        }
+        std::ranges::copy(path, std::begin(address.sun_path));
+
+        IpcServer server;
+        server.handlers_ = std::move(handlers);
+        server.listener_.reset(::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        if (!server.listener_) {
+            return std::unexpected(make_system_error("Failed to create IPC socket"));
+        }
+
+        if (!bind_socket(server.listener_.get(), address)) {
+            if (errno != EADDRINUSE) {
+                return std::unexpected(make_system_error("Failed to bind IPC socket"));
+            }
+
+            // A socket file is left behind by a backend that did not shut down cleanly
+            if (is_served(address)) {
+                return std::unexpected(make_environment_error("Another backend is already serving the IPC socket"));
+            }
+            logger.warn("Removing stale IPC socket: {}", path);
+            std::error_code error;
+            std::filesystem::remove(socket_path, error);
+
+            if (!bind_socket(server.listener_.get(), address)) {
+                return std::unexpected(make_system_error("Failed to bind IPC socket"));
+            }
+        }
+        server.socket_path_ = socket_path;
+
+        if (::listen(server.listener_.get(), SOMAXCONN) < 0) {
+            return std::unexpected(make_system_error("Failed to listen on IPC socket"));
+        }
+
+        server.started_ = Clock::now();
+        server.pending_counts_.resize(KEY_CNT);
+        logger.info("Serving IPC on: {}", path);
+        return server;
+    }
+
+    IpcServer(const IpcServer&) = delete;
+    auto operator=(const IpcServer&) -> IpcServer& = delete;
+    IpcServer(IpcServer&&) noexcept = default;
+    auto operator=(IpcServer&&) noexcept -> IpcServer& = default;
+
+    ~IpcServer()
+    {
+        if (listener_) {
+            std::error_code error;
+            std::filesystem::remove(socket_path_, error);
+        }
+    }
+
+    /// Counts a key press for the next live update
+    auto record_keystroke(std::uint32_t key_code) -> void
+    {
+        ++keys_pressed_;
+
+        if (subscribers_ == 0 || key_code >= pending_counts_.size()) {
+            return;
+        }
+        if (pending_counts_[key_code]++ == 0) {
+            dirty_keys_.push_back(key_code);
+        }
+    }
+
+    /// Appends the sockets to poll to the given set: the listening socket, then every client
+    auto add_poll_fds(std::vector<pollfd>& poll_fds) const -> void
+    {
+        poll_fds.push_back({.fd = listener_.get(), .events = POLLIN, .revents = 0});
+        for (const auto& connection : connections_) {
+            const auto events = connection.output.empty() ? POLLIN : (POLLIN | POLLOUT);
+            poll_fds.push_back({.fd = connection.socket.get(), .events = static_cast<short>(events), .revents = 0});
+        }
+    }
+
+    /// Accepts clients, handles their requests and sends due updates, without blocking
+    ///
+    /// Takes the entries added by add_poll_fds() after they were polled.
+    auto handle_events(std::span<const pollfd> poll_fds) -> void
+    {
+        // Connections accepted below are polled on the next call
+        for (std::size_t i = 0; i < connections_.size(); ++i) {
+            const auto revents = poll_fds[i + 1].revents;
+            auto& connection = connections_[i];
+
+            if ((revents & POLLIN) != 0) {
+                receive(connection);
+            } else if ((revents & (POLLERR | POLLHUP)) != 0) {
+                connection.closed = true;
+            }
+        }
+
+        if ((poll_fds.front().revents & POLLIN) != 0) {
+            accept_clients();
+        }
+
+        send_update();
+
+        for (auto& connection : connections_) {
+            send(connection);
+        }
+
+        std::erase_if(connections_, [](const Connection& connection) -> bool { return connection.closed; });
+        subscribers_ = static_cast<std::size_t>(std::ranges::count_if(
+          connections_, [](const Connection& connection) -> bool { return connection.subscription.has_value(); }));
+    }
+
+  private:
+    /// A connected client
+    struct Connection
+    {
+        common::ipc::Socket socket;
+        std::vector<std::byte> input;
+        std::vector<std::byte> output;
+        std::optional<std::uint32_t> subscription; ///< Request id of the subscription
+        bool closed{false};
+    };
+
+    /// Private constructor - use create() factory method
+    IpcServer() = default;
+
+    /// Binds a socket to an address and restricts the socket file to the user, returns false and keeps errno on failure
+    ///
+    /// The socket lives in a directory only the user can enter (see common::ipc::socket_path), so
+    /// nobody else can connect between binding and the chmod. The process umask is left alone, the
+    /// storage may be creating its files on another thread at the same time.
+    [[nodiscard]]
+    static auto bind_socket(int fd, const sockaddr_un& address) -> bool
+    {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            return false;
+        }
+        if (::chmod(static_cast<const char*>(address.sun_path), S_IRUSR | S_IWUSR) < 0) {
+            const int chmod_error = errno;
+            ::unlink(static_cast<const char*>(address.sun_path));
+            errno = chmod_error;
+            return false;
+        }
+        return true;
+    }
+
+    /// Returns whether a server accepts connections on the address
+    [[nodiscard]]
+    static auto is_served(const sockaddr_un& address) -> bool
+    {
+        const common::ipc::Socket probe(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        return probe && ::connect(probe.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    }
+
+    /// Accepts all pending clients
+    auto accept_clients() -> void
+    {
+        while (true) {
+            common::ipc::Socket client(::accept4(listener_.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+            if (!client) {
+                return;
+            }
+
+            if (connections_.size() >= IPC_MAX_CONNECTIONS) {
+                common::Logger::instance().warn("Rejecting IPC client: too many connections");
+                continue;
+            }
+
+            common::Logger::instance().debug("IPC client connected");
+            connections_.push_back(
+              {.socket = std::move(client), .input = {}, .output = {}, .subscription = {}, .closed = false});
+        }
+    }
+
+    /// Reads everything available from a client and handles its complete requests
+    auto receive(Connection& connection) -> void
+    {
+        std::array<std::byte, 4096> chunk{};
+        while (true) {
+            const auto received = ::recv(connection.socket.get(), chunk.data(), chunk.size(), MSG_DONTWAIT);
+            if (received > 0) {
+                connection.input.insert(connection.input.end(), chunk.begin(), chunk.begin() + received);
+                continue;
+            }
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                connection.closed = true;
+            }
+            break;
+        }
+
+        // Pipelined requests are handled in the order they were sent, also when the client
+        // closed its end right after sending them
+        std::size_t consumed = 0;
+        while (true) {
+            const auto frame = common::ipc::next_frame(std::span(connection.input).subspan(consumed));
+            if (frame.status == common::ipc::FrameStatus::INVALID) {
+                common::Logger::instance().warn("Closing IPC client: frame too large");
+                connection.closed = true;
+            }
+            if (frame.status != common::ipc::FrameStatus::COMPLETE) {
+                break;
+            }
+
+            handle(connection, frame.header, frame.payload);
+            consumed += frame.size;
+        }
+        connection.input.erase(connection.input.begin(),
+                               connection.input.begin() + static_cast<std::ptrdiff_t>(consumed));
+    }
+
+    /// Carries out a single request and queues its reply
+    auto handle(Connection& connection, const common::ipc::FrameHeader& header, std::span<const std::byte> payload)
+      -> void
+    {
+        using common::ipc::MessageType;
+        const auto id = header.request_id;
+
+        switch (header.type) {
+            case MessageType::FLUSH:
+                if (!handlers_.flush()) {
+                    reply_error(connection, id, "Buffered events could not be written yet");
+                    return;
+                }
+                reply(connection, MessageType::REPLY_OK, id);
+                return;
+
+            case MessageType::STATS: {
+                const auto buffer = handlers_.buffer_stats();
+                const common::ipc::StatsMessage stats{
+                  .uptime_seconds = static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - started_).count()),
+                  .keys_pressed = keys_pressed_,
+                  .buffered_events = buffer.buffered_events,
+                  .flushes = buffer.flushes};
+                reply(connection, MessageType::REPLY_STATS, id, common::ipc::payload_bytes(stats));
+                return;
+            }
+
+            case MessageType::RELOAD_CONFIG: {
+                const auto config = common::ipc::read_payload<common::ipc::ConfigMessage>(payload);
+                if (!config || config->log_level > MAX_LOG_LEVEL) {
+                    reply_error(connection, id, "Invalid configuration");
+                    return;
+                }
+                handlers_.reload_config(*config);
+                reply(connection, MessageType::REPLY_OK, id);
+                return;
+            }
+
+            case MessageType::SUBSCRIBE:
+                connection.subscription = id;
+                ++subscribers_;
+                reply(connection, MessageType::REPLY_OK, id);
+                return;
+
+            case MessageType::UNSUBSCRIBE:
+                connection.subscription.reset();
+                reply(connection, MessageType::REPLY_OK, id);
+                return;
+
+            case MessageType::STOP:
+                reply(connection, MessageType::REPLY_OK, id);
+                handlers_.stop();
+                return;
+
+            case MessageType::REPLY_OK:
+            case MessageType::REPLY_ERROR:
+            case MessageType::REPLY_STATS:
+            case MessageType::UPDATE:    break;
+        }
+
+        reply_error(connection, id, "Unknown request");
+    }
+
+    /// Sends the coalesced key presses to the subscribers, if the update interval has passed
+    auto send_update() -> void
+    {
+        const auto now = Clock::now();
+        if (dirty_keys_.empty() || now < next_update_) {
+            return;
+        }
+        next_update_ = now + std::chrono::milliseconds(IPC_UPDATE_INTERVAL_MS);
+
+        update_payload_.clear();
+        const common::ipc::UpdateMessage update{
+          .keys_pressed = keys_pressed_,
+          .delta_count = static_cast<std::uint32_t>(dirty_keys_.size()),
+          .reserved = 0,
+        };
+        const auto update_bytes = common::ipc::payload_bytes(update);
+        update_payload_.insert(update_payload_.end(), update_bytes.begin(), update_bytes.end());
+
+        for (const auto key_code : dirty_keys_) {
+            const common::ipc::KeyDelta delta{.key_code = key_code, .count = pending_counts_[key_code]};
+            const auto delta_bytes = common::ipc::payload_bytes(delta);
+            update_payload_.insert(update_payload_.end(), delta_bytes.begin(), delta_bytes.end());
+            pending_counts_[key_code] = 0;
+        }
+        dirty_keys_.clear();
+
+        for (auto& connection : connections_) {
+            if (connection.subscription && !connection.closed) {
+                reply(connection, common::ipc::MessageType::UPDATE, *connection.subscription, update_payload_);
+            }
+        }
+    }
+
+    /// Queues a message to a client, clients that stopped reading are disconnected
+    static auto reply(Connection& connection,
+                      common::ipc::MessageType type,
+                      std::uint32_t request_id,
+                      std::span<const std::byte> payload = {}) -> void
+    {
+        if (connection.output.size() > IPC_MAX_PENDING_BYTES) {
+            common::Logger::instance().warn("Closing IPC client: not reading its replies");
+            connection.closed = true;
+            return;
+        }
+        common::ipc::append_frame(connection.output, type, request_id, payload);
+    }
+
+    /// Queues an error reply with a message
+    static auto reply_error(Connection& connection, std::uint32_t request_id, std::string_view message) -> void
+    {
+        reply(connection, common::ipc::MessageType::REPLY_ERROR, request_id, std::as_bytes(std::span(message)));
+    }
+
+    /// Writes as much of the queued output as the socket takes
+    static auto send(Connection& connection) -> void
+    {
+        if (connection.closed || connection.output.empty()) {
+            return;
+        }
+
+        const auto sent = ::send(connection.socket.get(),
+                                 connection.output.data(),
+                                 connection.output.size(),
+                                 MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                connection.closed = true;
+            }
+            return;
+        }
+        connection.output.erase(connection.output.begin(), connection.output.begin() + sent);
+    }
+
+    /// Highest spdlog level, spdlog::level::off
+    static constexpr std::uint8_t MAX_LOG_LEVEL = 6;
+
+    Handlers handlers_;
+    common::ipc::Socket listener_;
+    std::filesystem::path socket_path_;
+    Clock::time_point started_;
+
+    std::vector<Connection> connections_;
+    std::size_t subscribers_{0};
+
+    std::uint64_t keys_pressed_{0};
+    std::vector<std::uint32_t> pending_counts_;
+    std::vector<std::uint32_t> dirty_keys_;
+    std::vector<std::byte> update_payload_;
+    Clock::time_point next_update_;
+};
+
+} // namespace typetrace::backend
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "errors.hpp"
+#include "keymap_names.hpp"
+#include "logger.hpp"
+#include "modifier_state.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <linux/input-event-codes.h>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <xkbcommon/xkbcommon-keysyms.h>
+#include <xkbcommon/xkbcommon.h>
+
+namespace typetrace::backend {
+
+/// Resolves scan codes to the characters they type in the configured keyboard layout
+///
+/// The keymap is compiled once and the character of every key for every shift level is stored
+/// in a lookup table. Resolving a key press is a table lookup, no xkb_state is kept at runtime.
+/// Only the first layout of the keymap is cached, switching to another layout group is not
+/// followed since the group is only known to the compositor.
+class KeymapCache final
+{
+  public:
+    /// Factory method to create a KeymapCache instance
+    [[nodiscard]]
+    static auto create(const KeymapNames& names) -> std::expected<KeymapCache, Error>
+    {
+        auto& logger = common::Logger::instance();
+        logger.info("Compiling keymap for layout '{}'...", names.layout.empty() ? "default" : names.layout);
+
+        const std::unique_ptr<struct xkb_context, decltype(&xkb_context_unref)> context(
+          xkb_context_new(XKB_CONTEXT_NO_FLAGS), &xkb_context_unref);
+        if (context == nullptr) {
+            return std::unexpected(make_system_error("Failed to create xkb context"));
+        }
+
+        const auto rule_names = names.rule_names();
+        const std::unique_ptr<struct xkb_keymap, decltype(&xkb_keymap_unref)> keymap(
+          xkb_keymap_new_from_names(context.get(), &rule_names, XKB_KEYMAP_COMPILE_NO_FLAGS), &xkb_keymap_unref);
+        if (keymap == nullptr) {
+            return std::unexpected(make_system_error("Failed to compile xkb keymap"));
+        }
+
+        const std::unique_ptr<struct xkb_state, decltype(&xkb_state_unref)> state(xkb_state_new(keymap.get()),
+                                                                                  &xkb_state_unref);
+        if (state == nullptr) {
+            return std::unexpected(make_system_error("Failed to create xkb state"));
+        }
+
+        KeymapCache cache;
+        cache.table_.resize(LEVEL_COUNT * KEY_COUNT);
+
+        const auto shift = xkb_keymap_mod_get_index(keymap.get(), XKB_MOD_NAME_SHIFT);
+        // AltGr selects the third level through Mod5 in the common layouts
+        const auto level_three = xkb_keymap_mod_get_index(keymap.get(), "Mod5");
+
+        for (std::size_t level = 0; level < LEVEL_COUNT; ++level) {
+            xkb_mod_mask_t depressed = 0;
+            if ((level & SHIFT_LEVEL) != 0 && shift != XKB_MOD_INVALID) {
+                depressed |= 1U << shift;
+            }
+            if ((level & LEVEL_THREE_LEVEL) != 0 && level_three != XKB_MOD_INVALID) {
+                depressed |= 1U << level_three;
+            }
+            xkb_state_update_mask(state.get(), depressed, 0, 0, 0, 0, 0);
+
+            for (std::uint32_t key_code = 0; key_code < KEY_COUNT; ++key_code) {
+                cache.table_[index(level, key_code)] = resolve(state.get(), key_code);
+            }
+        }
+
+        // Layouts with a third level bind it to the right Alt key, on the others it is a plain Alt
+        xkb_state_update_mask(state.get(), 0, 0, 0, 0, 0, 0);
+        const auto right_alt = xkb_state_key_get_one_sym(state.get(), KEY_RIGHTALT + EVDEV_OFFSET);
+        cache.right_alt_is_altgr_ = right_alt == XKB_KEY_ISO_Level3_Shift || right_alt == XKB_KEY_Mode_switch;
+
+        logger.info("Keymap cached, right Alt acts as {}", cache.right_alt_is_altgr_ ? "AltGr" : "Alt");
+        return cache;
+    }
+
+    /// Returns whether the right Alt key selects the third shift level (AltGr) in this layout
+    [[nodiscard]]
+    auto right_alt_is_altgr() const -> bool
+    {
+        return right_alt_is_altgr_;
+    }
+
+    /// Returns the character typed by a key with the given modifiers, if it types one
+    [[nodiscard]]
+    auto character(std::uint32_t key_code, ModifierMask modifiers) const -> std::optional<common::Character>
+    {
+        // Shortcuts do not type characters
+        if ((modifiers & (MODIFIER_CTRL | MODIFIER_ALT | MODIFIER_SUPER)) != 0 || key_code >= KEY_COUNT) {
+            return std::nullopt;
+        }
+
+        std::size_t level = 0;
+        level |= (modifiers & MODIFIER_SHIFT) != 0 ? SHIFT_LEVEL : 0U;
+        level |= (modifiers & MODIFIER_ALTGR) != 0 ? LEVEL_THREE_LEVEL : 0U;
+
+        const auto& character = table_[index(level, key_code)];
+        if (character.front() == '\0') {
+            return std::nullopt;
+        }
+        return character;
+    }
+
+    /// Returns the memory reserved by the lookup table, the compiled keymap is released after creation
+    [[nodiscard]]
+    auto bytes() const -> std::size_t
+    {
+        return table_.capacity() * sizeof(common::Character);
+    }
+
+  private:
+    /// Number of evdev scan codes in the table
+    static constexpr std::size_t KEY_COUNT = KEY_CNT;
+
+    /// Shift levels in the table: none, Shift, AltGr, Shift+AltGr
+    static constexpr std::size_t LEVEL_COUNT = 4;
+    static constexpr std::size_t SHIFT_LEVEL = 1U << 0U;
+    static constexpr std::size_t LEVEL_THREE_LEVEL = 1U << 1U;
+
+    /// Offset between evdev scan codes and xkb keycodes
+    static constexpr std::uint32_t EVDEV_OFFSET = 8;
+
+    /// Private constructor - use create() factory method
+    KeymapCache() = default;
+
+    /// Returns the position of a key in the lookup table
+    [[nodiscard]]
+    static constexpr auto index(std::size_t level, std::uint32_t key_code) -> std::size_t
+    {
+        return (level * KEY_COUNT) + key_code;
+    }
+
+    /// Resolves the printable character of a key in the given state, control characters are dropped
+    [[nodiscard]]
+    static auto resolve(struct xkb_state* state, std::uint32_t key_code) -> common::Character
+    {
+        common::Character character{};
+
+        const auto length = xkb_state_key_get_utf8(state, key_code + EVDEV_OFFSET, character.data(), character.size());
+        const auto first = static_cast<unsigned char>(character.front());
+        if (length <= 0 || static_cast<std::size_t>(length) >= character.size() || first < 0x20 || first == 0x7F) {
+            return {};
+        }
+
+        return character;
+    }
+
+    std::vector<common::Character> table_;
+    bool right_alt_is_altgr_{false};
+};
+
+} // namespace typetrace::backend
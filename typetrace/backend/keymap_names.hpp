@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <xkbcommon/xkbcommon.h>
+
+namespace typetrace::backend {
+
+/// Rules, model, layout, variant and options (RMLVO) that select a keyboard layout
+///
+/// Empty names are left to xkbcommon, which fills them from the XKB_DEFAULT_* environment
+/// variables or its built-in defaults.
+struct KeymapNames
+{
+    std::string rules;
+    std::string model;
+    std::string layout;
+    std::string variant;
+    std::string options;
+
+    /// Returns the keyboard layout configured for the system
+    ///
+    /// The XKB_DEFAULT_* environment variables take precedence. Otherwise the X11 keyboard
+    /// configuration written by localectl is read, then vconsole.conf and the Debian keyboard
+    /// configuration. No compositor is asked, so a layout chosen only in the desktop settings
+    /// is not seen.
+    [[nodiscard]]
+    static auto configured() -> KeymapNames
+    {
+        if (const char* layout = std::getenv("XKB_DEFAULT_LAYOUT"); layout != nullptr && *layout != '\0') {
+            return {};
+        }
+
+        if (auto names = from_xorg_config(XORG_KEYBOARD_CONFIG); !names.layout.empty()) {
+            return names;
+        }
+        for (const auto* const path : SHELL_KEYBOARD_CONFIGS) {
+            if (auto names = from_shell_config(path); !names.layout.empty()) {
+                return names;
+            }
+        }
+        return {};
+    }
+
+    /// Returns the names in the form xkbcommon takes, valid as long as this object is
+    [[nodiscard]]
+    auto rule_names() const -> xkb_rule_names
+    {
+        const auto name_or_null = [](const std::string& name) -> const char* {
+            return name.empty() ? nullptr : name.c_str();
+        };
+        return {.rules = name_or_null(rules),
+                .model = name_or_null(model),
+                .layout = name_or_null(layout),
+                .variant = name_or_null(variant),
+                .options = name_or_null(options)};
+    }
+
+  private:
+    /// Keyboard configuration of the X server, also written by `localectl set-x11-keymap`
+    static constexpr std::string_view XORG_KEYBOARD_CONFIG = "/etc/X11/xorg.conf.d/00-keyboard.conf";
+
+    /// Shell-style keyboard configurations with XKBLAYOUT=... assignments
+    static constexpr std::array<const char*, 2> SHELL_KEYBOARD_CONFIGS = {"/etc/vconsole.conf",
+                                                                          "/etc/default/keyboard"};
+
+    /// Reads the Option "Xkb..." lines of an xorg.conf section
+    [[nodiscard]]
+    static auto from_xorg_config(const std::filesystem::path& path) -> KeymapNames
+    {
+        KeymapNames names;
+        std::ifstream file(path);
+        std::string line;
+
+        while (std::getline(file, line)) {
+            const auto indent = std::min(line.find_first_not_of(" \t"), line.size());
+            const bool is_option = std::string_view(line).substr(indent).starts_with("Option");
+            const auto values = quoted_values(line);
+            if (!is_option || values.size() != 2) {
+                continue;
+            }
+
+            const auto& key = values[0];
+            if (key == "XkbRules") {
+                names.rules = values[1];
+            } else if (key == "XkbModel") {
+                names.model = values[1];
+            } else if (key == "XkbLayout") {
+                names.layout = values[1];
+            } else if (key == "XkbVariant") {
+                names.variant = values[1];
+            } else if (key == "XkbOptions") {
+                names.options = values[1];
+            }
+        }
+
+        return names;
+    }
+
+    /// Reads the XKB* assignments of a shell-style configuration file
+    [[nodiscard]]
+    static auto from_shell_config(const std::filesystem::path& path) -> KeymapNames
+    {
+        KeymapNames names;
+        std::ifstream file(path);
+        std::string line;
+
+        while (std::getline(file, line)) {
+            const auto separator = line.find('=');
+            if (line.starts_with('#') || separator == std::string::npos) {
+                continue;
+            }
+
+            const std::string_view key = std::string_view(line).substr(0, separator);
+            std::string value = line.substr(separator + 1);
+            if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front()) {
+                value = value.substr(1, value.size() - 2);
+            }
+
+            if (key == "XKBRULES") {
+                names.rules = value;
+            } else if (key == "XKBMODEL") {
+                names.model = value;
+            } else if (key == "XKBLAYOUT") {
+                names.layout = value;
+            } else if (key == "XKBVARIANT") {
+                names.variant = value;
+            } else if (key == "XKBOPTIONS") {
+                names.options = value;
+            }
+        }
+
+        return names;
+    }
+
+    /// Returns the double-quoted strings of a line
+    [[nodiscard]]
+    static auto quoted_values(std::string_view line) -> std::vector<std::string>
+    {
+        std::vector<std::string> values;
+
+        std::size_t begin = line.find('"');
+        while (begin != std::string_view::npos) {
+            const auto end = line.find('"', begin + 1);
+            if (end == std::string_view::npos) {
+                break;
+            }
+            values.emplace_back(line.substr(begin + 1, end - begin - 1));
+            begin = line.find('"', end + 1);
+        }
+
+        return values;
+    }
+};
+
+} // namespace typetrace::backend
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "constants.hpp"
+#include "errors.hpp"
+#include "logger.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <malloc.h>
+#include <sqlite3.h>
+#include <unistd.h>
+
+namespace typetrace::backend {
+
+/// Memory reserved by the event handler, reported by the event handler itself
+struct HandlerMemory
+{
+    std::size_t buffer_bytes{0};      ///< Queued keystrokes, characters, chords and typing sessions
+    std::size_t chord_table_bytes{0}; ///< Dense chord table of the current day
+    std::size_t keymap_bytes{0};      ///< Lookup table of the keymap cache, zero without character tracking
+};
+
+/// Memory usage of the backend process by component
+struct MemoryUsage
+{
+    std::size_t rss_bytes{0};              ///< Resident set size of the whole process
+    std::size_t sqlite_bytes{0};           ///< Heap currently used by SQLite, including the page cache
+    std::size_t sqlite_highwater_bytes{0}; ///< Highest SQLite heap usage since startup
+    HandlerMemory handler;                 ///< Buffers and lookup tables of the event handler
+
+    /// Measures the current memory usage, the event handler reports its own share
+    [[nodiscard]]
+    static auto measure(const HandlerMemory& handler) -> MemoryUsage
+    {
+        MemoryUsage usage{.rss_bytes = 0, .sqlite_bytes = 0, .sqlite_highwater_bytes = 0, .handler = handler};
+
+        // Second field of statm is the number of resident pages
+        std::size_t total_pages = 0;
+        std::size_t resident_pages = 0;
+        if (std::ifstream statm("/proc/self/statm"); statm >> total_pages >> resident_pages) {
+            usage.rss_bytes = resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        }
+
+        usage.sqlite_bytes = static_cast<std::size_t>(sqlite3_memory_used());
+        usage.sqlite_highwater_bytes = static_cast<std::size_t>(sqlite3_memory_highwater(0));
+
+        return usage;
+    }
+
+    /// Returns the memory not attributed to a known component (code, libinput, spdlog, ...)
+    [[nodiscard]]
+    auto other_bytes() const -> std::size_t
+    {
+        const auto known = sqlite_bytes + handler.buffer_bytes + handler.chord_table_bytes + handler.keymap_bytes;
+        return rss_bytes > known ? rss_bytes - known : 0;
+    }
+};
+
+/// Memory ceiling of the backend and its split over the components
+///
+/// SQLite gets half of the budget as soft heap limit, of which half is page cache. Every event
+/// queue of the event handler gets the same capacity, together they take a 64th of the budget.
+/// The rest is left for code, libinput, spdlog and the fixed chord and keymap tables.
+struct MemoryBudget
+{
+    std::size_t total_bytes{0};
+    std::size_t sqlite_heap_limit_bytes{0};
+    std::size_t sqlite_cache_kib{0};
+    std::size_t buffer_capacity{0};
+
+    /// Splits a budget given in MiB over the components
+    [[nodiscard]]
+    static auto from_mebibytes(std::size_t mebibytes) -> std::expected<MemoryBudget, Error>
+    {
+        if (mebibytes < MIN_MEMORY_BUDGET_MIB) {
+            return std::unexpected(make_environment_error("Memory budget is too small for the backend to run"));
+        }
+
+        constexpr std::size_t MIB = 1024 * 1024;
+        const auto total_bytes = mebibytes * MIB;
+
+        return MemoryBudget{
+          .total_bytes = total_bytes,
+          .sqlite_heap_limit_bytes = total_bytes / 2,
+          .sqlite_cache_kib = total_bytes / 4 / 1024,
+          .buffer_capacity = std::max(BUFFER_SIZE, total_bytes / 64 / QUEUED_EVENT_BYTES),
+        };
+    }
+
+    /// Bytes of one event in each of the event queues
+    static constexpr std::size_t QUEUED_EVENT_BYTES = sizeof(common::KeystrokeEvent) + sizeof(common::CharacterEvent)
+                                                    + sizeof(common::ChordEvent) + sizeof(common::TypingSession);
+
+    /// Applies the process-wide SQLite limits, must be called before any connection is opened
+    auto apply() const -> void
+    {
+        sqlite3_soft_heap_limit64(static_cast<sqlite3_int64>(sqlite_heap_limit_bytes));
+
+        common::Logger::instance().info(
+          "Memory budget: {} KiB total, SQLite heap limit {} KiB, page cache {} KiB, {} events per queue",
+          total_bytes / 1024,
+          sqlite_heap_limit_bytes / 1024,
+          sqlite_cache_kib,
+          buffer_capacity);
+    }
+
+    /// Logs the measured memory usage by component, returns whether it is within the budget
+    [[nodiscard]]
+    auto report(const MemoryUsage& usage) const -> bool
+    {
+        common::Logger::instance().info(
+          "Memory usage: RSS {} KiB (SQLite {} KiB, peak {} KiB; buffers {} KiB; chord table {} KiB; keymap {} KiB; "
+          "other {} KiB)",
+          usage.rss_bytes / 1024,
+          usage.sqlite_bytes / 1024,
+          usage.sqlite_highwater_bytes / 1024,
+          usage.handler.buffer_bytes / 1024,
+          usage.handler.chord_table_bytes / 1024,
+          usage.handler.keymap_bytes / 1024,
+          usage.other_bytes() / 1024);
+
+        return usage.rss_bytes <= total_bytes;
+    }
+
+    /// Hands memory that is not in use back to the system: the unused part of the SQLite page
+    /// cache and the free heap of the allocator
+    static auto release_free_memory() -> void
+    {
+        sqlite3_release_memory(std::numeric_limits<int>::max());
+        malloc_trim(0);
+    }
+};
+
+} // namespace typetrace::backend
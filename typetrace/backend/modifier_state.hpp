@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/input-event-codes.h>
+
+namespace typetrace::backend {
+
+/// Bitmask of held modifiers, see the MODIFIER_* constants
+using ModifierMask = std::uint8_t;
+
+constexpr ModifierMask MODIFIER_SHIFT = 1U << 0U;
+constexpr ModifierMask MODIFIER_CTRL = 1U << 1U;
+constexpr ModifierMask MODIFIER_ALT = 1U << 2U;
+constexpr ModifierMask MODIFIER_ALTGR = 1U << 3U;
+constexpr ModifierMask MODIFIER_SUPER = 1U << 4U;
+
+/// Number of distinct modifier masks
+constexpr std::size_t MODIFIER_COMBINATIONS = 1U << 5U;
+
+/// Tracks the held modifiers from key press and release events
+///
+/// Left and right modifier keys are tracked separately, so releasing one of them keeps the
+/// modifier held while the other one is still down. The right Alt key counts as Alt unless
+/// the keyboard layout binds it to AltGr.
+class ModifierState final
+{
+  public:
+    /// Sets whether the right Alt key is AltGr, as reported by the keymap
+    auto set_right_alt_is_altgr(bool altgr) -> void
+    {
+        right_alt_is_altgr_ = altgr;
+        mask_ = mask_of(held_keys_);
+    }
+
+    /// Updates the state with a key event, returns whether the key is a modifier
+    auto update(std::uint32_t key_code, bool pressed) -> bool
+    {
+        const auto key_bit = modifier_key_bit(key_code);
+        if (key_bit == 0) {
+            return false;
+        }
+
+        held_keys_ = static_cast<std::uint8_t>(pressed ? (held_keys_ | key_bit) : (held_keys_ & ~key_bit));
+        mask_ = mask_of(held_keys_);
+        return true;
+    }
+
+    /// Returns the currently held modifiers
+    [[nodiscard]]
+    auto mask() const -> ModifierMask
+    {
+        return mask_;
+    }
+
+    /// Returns whether the key is a modifier key
+    [[nodiscard]]
+    static constexpr auto is_modifier(std::uint32_t key_code) -> bool
+    {
+        return modifier_key_bit(key_code) != 0;
+    }
+
+  private:
+    // One bit per physical modifier key
+    static constexpr std::uint8_t LEFT_SHIFT = 1U << 0U;
+    static constexpr std::uint8_t RIGHT_SHIFT = 1U << 1U;
+    static constexpr std::uint8_t LEFT_CTRL = 1U << 2U;
+    static constexpr std::uint8_t RIGHT_CTRL = 1U << 3U;
+    static constexpr std::uint8_t LEFT_ALT = 1U << 4U;
+    static constexpr std::uint8_t RIGHT_ALT = 1U << 5U;
+    static constexpr std::uint8_t LEFT_META = 1U << 6U;
+    static constexpr std::uint8_t RIGHT_META = 1U << 7U;
+
+    /// Returns the bit of a physical modifier key, or 0 for other keys
+    [[nodiscard]]
+    static constexpr auto modifier_key_bit(std::uint32_t key_code) -> std::uint8_t
+    {
+        switch (key_code) {
+            case KEY_LEFTSHIFT:  return LEFT_SHIFT;
+            case KEY_RIGHTSHIFT: return RIGHT_SHIFT;
+            case KEY_LEFTCTRL:   return LEFT_CTRL;
+            case KEY_RIGHTCTRL:  return RIGHT_CTRL;
+            case KEY_LEFTALT:    return LEFT_ALT;
+            case KEY_RIGHTALT:   return RIGHT_ALT;
+            case KEY_LEFTMETA:   return LEFT_META;
+            case KEY_RIGHTMETA:  return RIGHT_META;
+            default:             return 0;
+        }
+    }
+
+    /// Folds the held physical keys into a modifier mask
+    [[nodiscard]]
+    auto mask_of(std::uint8_t held_keys) const -> ModifierMask
+    {
+        const auto alt_keys = LEFT_ALT | (right_alt_is_altgr_ ? 0U : RIGHT_ALT);
+        const auto altgr_keys = right_alt_is_altgr_ ? RIGHT_ALT : 0U;
+
+        unsigned int mask = 0;
+        mask |= (held_keys & (LEFT_SHIFT | RIGHT_SHIFT)) != 0 ? MODIFIER_SHIFT : 0U;
+        mask |= (held_keys & (LEFT_CTRL | RIGHT_CTRL)) != 0 ? MODIFIER_CTRL : 0U;
+        mask |= (held_keys & alt_keys) != 0 ? MODIFIER_ALT : 0U;
+        mask |= (held_keys & altgr_keys) != 0 ? MODIFIER_ALTGR : 0U;
+        mask |= (held_keys & (LEFT_META | RIGHT_META)) != 0 ? MODIFIER_SUPER : 0U;
+        return static_cast<ModifierMask>(mask);
+    }
+
+    std::uint8_t held_keys_{0};
+    ModifierMask mask_{0};
+    bool right_alt_is_altgr_{false};
+};
+
+} // namespace typetrace::backend
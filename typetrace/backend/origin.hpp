@@ -0,0 +1,52 @@
+#pragma once
+
+#include "logger.hpp"
+
+#include <array>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+namespace typetrace::backend {
+
+/// Returns a stable identifier of this machine, used as the origin of its keystroke counts
+///
+/// The identifier is derived from the systemd machine id (or the host name as a fallback) and
+/// hashed, so the machine id itself is never stored in the database.
+[[nodiscard]]
+inline auto local_origin() -> std::string
+{
+    std::string machine_id;
+
+    if (std::ifstream machine_id_file("/etc/machine-id"); machine_id_file) {
+        std::getline(machine_id_file, machine_id);
+    }
+
+    if (machine_id.empty()) {
+        std::array<char, 256> host_name{};
+        if (gethostname(host_name.data(), host_name.size() - 1) == 0) {
+            machine_id = host_name.data();
+        }
+        common::Logger::instance().warn("No machine id available, using the host name as origin");
+    }
+
+    // 64-bit FNV-1a, salted so the origin differs from ids other applications derive
+    constexpr std::uint64_t FNV_OFFSET_BASIS = 14'695'981'039'346'656'037ULL;
+    constexpr std::uint64_t FNV_PRIME = 1'099'511'628'211ULL;
+    constexpr std::string_view SALT = "typetrace-origin";
+
+    std::uint64_t hash = FNV_OFFSET_BASIS;
+    for (const std::string_view part : {SALT, std::string_view(machine_id)}) {
+        for (const char character : part) {
+            hash ^= static_cast<unsigned char>(character);
+            hash *= FNV_PRIME;
+        }
+    }
+
+    return std::format("{:016x}", hash);
+}
+
+} // namespace typetrace::backend
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "clock.hpp"
+#include "constants.hpp"
+#include "time_source.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace typetrace::backend {
+
+/// Segments key presses into typing sessions as they arrive
+///
+/// A session is open from its first key press until no key was pressed for SESSION_IDLE_GAP
+/// seconds. The typing rate is the amount of key presses in the last SESSION_RATE_WINDOW
+/// seconds, kept in a ring of per-second buckets, so recording a key press is O(1).
+class SessionTracker final
+{
+  public:
+    /// Records a key press, returns the previous session if the idle gap closed it
+    ///
+    /// The wall clock and date of the time source are only read when a session starts.
+    auto record(Clock::time_point time, const TimeSource& time_source) -> std::optional<common::TypingSession>
+    {
+        auto closed = expire(time);
+
+        if (!open_) {
+            start(time, time_source);
+        }
+
+        advance(seconds_of(time));
+        ++bucket(bucket_second_);
+        ++window_keys_;
+
+        ++key_count_;
+        peak_rate_ = std::max(peak_rate_, window_keys_);
+        last_key_ = time;
+
+        return closed;
+    }
+
+    /// Closes the open session if no key was pressed for the idle gap
+    auto expire(Clock::time_point now) -> std::optional<common::TypingSession>
+    {
+        if (!open_ || now - last_key_ < std::chrono::seconds(SESSION_IDLE_GAP)) {
+            return std::nullopt;
+        }
+        return close();
+    }
+
+    /// Closes the open session regardless of the idle gap, e.g. at shutdown
+    auto close() -> std::optional<common::TypingSession>
+    {
+        if (!open_) {
+            return std::nullopt;
+        }
+        open_ = false;
+
+        // The wall clock is only read at the start, so clock adjustments do not distort the duration
+        const auto duration = std::chrono::duration_cast<std::chrono::seconds>(last_key_ - first_key_);
+        return common::TypingSession{
+          .start = start_time_,
+          .end = start_time_ + duration,
+          .date = start_date_,
+          .key_count = key_count_,
+          .peak_keys_per_minute = peak_rate_ * 60 / static_cast<std::uint32_t>(SESSION_RATE_WINDOW),
+        };
+    }
+
+  private:
+    /// Opens a new session with its first key press
+    auto start(Clock::time_point time, const TimeSource& time_source) -> void
+    {
+        open_ = true;
+        first_key_ = time;
+        start_time_ = time_source.wall_now();
+        start_date_ = time_source.today();
+        key_count_ = 0;
+        peak_rate_ = 0;
+
+        buckets_.fill(0);
+        window_keys_ = 0;
+        bucket_second_ = seconds_of(time);
+    }
+
+    /// Moves the window forward to the given second, dropping the buckets that fell out of it
+    auto advance(std::int64_t second) -> void
+    {
+        if (second <= bucket_second_) {
+            return;
+        }
+
+        if (second - bucket_second_ >= static_cast<std::int64_t>(SESSION_RATE_WINDOW)) {
+            buckets_.fill(0);
+            window_keys_ = 0;
+        } else {
+            for (auto expired = bucket_second_ + 1; expired <= second; ++expired) {
+                auto& expired_bucket = bucket(expired);
+                window_keys_ -= expired_bucket;
+                expired_bucket = 0;
+            }
+        }
+
+        bucket_second_ = second;
+    }
+
+    /// Returns the bucket of the given second
+    [[nodiscard]]
+    auto bucket(std::int64_t second) -> std::uint32_t&
+    {
+        return buckets_[static_cast<std::size_t>(second) % SESSION_RATE_WINDOW];
+    }
+
+    /// Returns the whole seconds of a monotonic time point
+    [[nodiscard]]
+    static auto seconds_of(Clock::time_point time) -> std::int64_t
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+    }
+
+    bool open_{false};
+    Clock::time_point first_key_;
+    Clock::time_point last_key_;
+    std::chrono::sys_seconds start_time_;
+    std::chrono::year_month_day start_date_;
+    std::uint32_t key_count_{0};
+    std::uint32_t peak_rate_{0}; ///< Most key presses within one rate window
+
+    std::array<std::uint32_t, SESSION_RATE_WINDOW> buckets_{};
+    std::uint32_t window_keys_{0};
+    std::int64_t bucket_second_{0}; ///< Second of the newest bucket
+};
+
+} // namespace typetrace::backend
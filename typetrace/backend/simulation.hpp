@@ -0,0 +1,916 @@
+#pragma once
+
+#include "clock.hpp"
+#include "constants.hpp"
+#include "date.hpp"
+#include "errors.hpp"
+#include "event_handler.hpp"
+#include "keymap_cache.hpp"
+#include "keymap_names.hpp"
+#include "macros.hpp"
+#include "modifier_state.hpp"
+#include "storage_engine.hpp"
+#include "time_source.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <linux/input-event-codes.h>
+#include <map>
+#include <memory>
+#include <print>
+#include <random>
+#include <span>
+#include <string_view>
+#include <sys/wait.h>
+#include <system_error>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Event counts of the simulation, keyed by day number first
+struct SimulatedCounts
+{
+    /// Key presses per day and scan code
+    std::map<std::pair<std::int32_t, std::uint32_t>, std::uint64_t> keystrokes;
+    /// Typed characters per day and character
+    std::map<std::pair<std::int32_t, common::Character>, std::uint64_t> characters;
+    /// Chords per day, modifiers and scan code
+    std::map<std::tuple<std::int32_t, ModifierMask, std::uint32_t>, std::uint64_t> chords;
+
+    auto operator==(const SimulatedCounts&) const -> bool = default;
+
+    /// Adds the events of a batch that fall into the given year
+    auto add(const common::FlushBatch& batch, std::chrono::year year) -> void
+    {
+        for (const auto& event : batch.keystrokes) {
+            if (event.date.year() == year) {
+                keystrokes[{common::to_day_number(event.date), event.key_code}] += event.count;
+            }
+        }
+        for (const auto& event : batch.characters) {
+            if (event.date.year() == year) {
+                characters[{common::to_day_number(event.date), event.character}] += event.count;
+            }
+        }
+        for (const auto& event : batch.chords) {
+            if (event.date.year() == year) {
+                chords[{common::to_day_number(event.date), event.modifiers, event.key_code}] += event.count;
+            }
+        }
+    }
+
+    /// Moves the counts of a year to another instance
+    auto move_year(std::chrono::year year, SimulatedCounts& target) -> void
+    {
+        const auto move = [year](auto& from, auto& to) -> void {
+            for (auto entry = from.begin(); entry != from.end();) {
+                if (common::from_day_number(std::get<0>(entry->first)).year() == year) {
+                    to[entry->first] += entry->second;
+                    entry = from.erase(entry);
+                } else {
+                    ++entry;
+                }
+            }
+        };
+
+        move(keystrokes, target.keystrokes);
+        move(characters, target.characters);
+        move(chords, target.chords);
+    }
+
+    /// Returns whether no event is counted
+    [[nodiscard]]
+    auto empty() const -> bool
+    {
+        return keystrokes.empty() && characters.empty() && chords.empty();
+    }
+};
+
+/// Storage engine of the simulation, keeps the counts in memory and fails writes on request
+///
+/// Like the SQLite storage, a batch is committed one year at a time and a failure only rolls back
+/// the year it happened in. Every year that passes the injected failures can also be written to a
+/// real storage engine, which then has to hold the same counts.
+class SimulatedStorage final : public StorageEngine
+{
+  public:
+    /// Decides whether writing the events of a year fails, e.g. its partition cannot be created
+    using FailureInjector = std::function<bool(std::chrono::year)>;
+
+    /// Sets the function deciding which writes fail
+    auto set_failure_injector(FailureInjector injector) -> void
+    {
+        failure_injector_ = std::move(injector);
+    }
+
+    /// Sets a real storage engine every committed year is written to as well, a failure there fails the year
+    auto set_durable_storage(StorageEngine* storage) -> void
+    {
+        durable_storage_ = storage;
+    }
+
+    /// Adds the events of a batch year by year, stopping at the first year that fails
+    [[nodiscard]]
+    auto write(const common::FlushBatch& batch) -> std::expected<void, Error> override
+    {
+        committed_years_.clear();
+
+        for (const auto year : batch_years(batch)) {
+            if (failure_injector_ && failure_injector_(year)) {
+                return std::unexpected(make_database_error("Simulated write failure"));
+            }
+            if (durable_storage_ != nullptr) {
+                TRY(write_durable(batch, year));
+            }
+
+            counts_.add(batch, year);
+            std::ranges::copy_if(batch.sessions,
+                                 std::back_inserter(sessions_),
+                                 [year](const common::TypingSession& session) -> bool {
+                                     return session.date.year() == year;
+                                 });
+            committed_years_.push_back(year);
+        }
+
+        return {};
+    }
+
+    /// Returns the total amount of key presses per day between two dates (inclusive)
+    [[nodiscard]]
+    auto daily_counts(std::chrono::year_month_day from, std::chrono::year_month_day to)
+      -> std::expected<std::vector<common::DailyCount>, Error> override
+    {
+        std::vector<common::DailyCount> counts;
+
+        const auto last_day = common::to_day_number(to);
+        for (auto entry = counts_.keystrokes.lower_bound({common::to_day_number(from), 0});
+             entry != counts_.keystrokes.end() && entry->first.first <= last_day;
+             ++entry) {
+            const auto date = common::from_day_number(entry->first.first);
+            if (counts.empty() || counts.back().date != date) {
+                counts.push_back({.date = date, .total = 0});
+            }
+            counts.back().total += entry->second;
+        }
+
+        return counts;
+    }
+
+    /// Returns the name of the storage engine
+    [[nodiscard]]
+    auto name() const -> std::string_view override
+    {
+        return "simulated";
+    }
+
+    /// Returns the stored event counts
+    [[nodiscard]]
+    auto counts() const -> const SimulatedCounts&
+    {
+        return counts_;
+    }
+
+    /// Returns the stored typing sessions in the order they were written
+    [[nodiscard]]
+    auto sessions() const -> const std::vector<common::TypingSession>&
+    {
+        return sessions_;
+    }
+
+    /// Returns the years committed by the last write, also when a later year of it failed
+    [[nodiscard]]
+    auto committed_years() const -> std::span<const std::chrono::year>
+    {
+        return committed_years_;
+    }
+
+  private:
+    /// Writes the events of a year in a batch to the real storage engine
+    [[nodiscard]]
+    auto write_durable(const common::FlushBatch& batch, std::chrono::year year) -> std::expected<void, Error>
+    {
+        const auto keystrokes = events_of_year(batch.keystrokes, year);
+        const auto characters = events_of_year(batch.characters, year);
+        const auto chords = events_of_year(batch.chords, year);
+        const auto sessions = events_of_year(batch.sessions, year);
+
+        return durable_storage_->write(
+          {.keystrokes = keystrokes, .characters = characters, .chords = chords, .sessions = sessions});
+    }
+
+    /// Returns the events that fall into the given year
+    template<typename Event>
+    [[nodiscard]]
+    static auto events_of_year(std::span<const Event> events, std::chrono::year year) -> std::vector<Event>
+    {
+        std::vector<Event> selected;
+        std::ranges::copy_if(events, std::back_inserter(selected), [year](const Event& event) -> bool {
+            return event.date.year() == year;
+        });
+        return selected;
+    }
+
+    /// Returns the distinct years of the events in a batch in ascending order
+    [[nodiscard]]
+    static auto batch_years(const common::FlushBatch& batch) -> std::vector<std::chrono::year>
+    {
+        std::vector<std::chrono::year> years;
+        const auto add_years = [&years](const auto& events) -> void {
+            for (const auto& event : events) {
+                years.push_back(event.date.year());
+            }
+        };
+
+        add_years(batch.keystrokes);
+        add_years(batch.characters);
+        add_years(batch.chords);
+        add_years(batch.sessions);
+
+        std::ranges::sort(years);
+        years.erase(std::ranges::unique(years).begin(), years.end());
+        return years;
+    }
+
+    FailureInjector failure_injector_;
+    StorageEngine* durable_storage_{nullptr};
+    SimulatedCounts counts_;
+    std::vector<common::TypingSession> sessions_;
+    std::vector<std::chrono::year> committed_years_;
+};
+
+/// Totals of a simulation run
+struct SimulationReport
+{
+    std::size_t scenarios{0};
+    std::size_t violations{0};
+    std::size_t abrupt_terminations{0};
+    std::uint64_t key_presses{0};
+    std::uint64_t failed_writes{0};
+    Clock::duration simulated_time{0};
+    bool characters_checked{false}; ///< Needs the keymap of the US layout
+};
+
+/// Deterministic simulation of the event handler with a simulated clock, input and storage
+///
+/// Each scenario is generated from its seed: bursts of typing, idle periods of up to a week,
+/// day and year rollovers, storage outages of all or only the new partitions and either a clean
+/// shutdown or an abrupt termination. The clock only stops where the poll loop of the backend
+/// could observe something, so idle periods cost nothing. After every scenario the stored key
+/// presses, characters and chords are checked against the ones expected from a fixed table of
+/// the pressed keys, independent of the modifier tracking and keymap of the handler.
+class Simulation final
+{
+  public:
+    /// Opens the real storage engine checked by run_durable(), always in the same directory
+    using StorageFactory = std::function<std::expected<std::unique_ptr<StorageEngine>, Error>()>;
+
+    /// Runs the given number of scenarios with consecutive seeds, violations are printed as found
+    [[nodiscard]]
+    static auto run(std::uint64_t seed, std::size_t scenarios) -> SimulationReport
+    {
+        return run_scenarios(seed, scenarios, [](Simulation& simulation) -> void {
+            simulation.run_scenario();
+            simulation.check_invariants();
+        });
+    }
+
+    /// Runs scenarios with consecutive seeds against a real storage engine in an empty directory
+    ///
+    /// Each scenario first runs in a child process that writes every committed year to the real
+    /// storage as well. An abrupt termination kills the child without closing the storage, so
+    /// reopening it has to recover from whatever the kill left behind, e.g. an uncheckpointed WAL.
+    /// The parent then runs the same scenario on the simulated storage alone, reopens the real one
+    /// and compares their daily key counts.
+    [[nodiscard]]
+    static auto run_durable(std::uint64_t seed,
+                            std::size_t scenarios,
+                            const std::filesystem::path& dir,
+                            const StorageFactory& open_storage) -> SimulationReport
+    {
+        return run_scenarios(seed, scenarios, [&dir, &open_storage](Simulation& simulation) -> void {
+            std::error_code error;
+            std::filesystem::remove_all(dir, error);
+            std::filesystem::create_directories(dir, error);
+            if (error) {
+                simulation.violation(std::format("failed to create the storage directory: {}", error.message()));
+                return;
+            }
+
+            simulation.run_in_child(open_storage);
+            simulation.run_scenario();
+            simulation.check_invariants();
+            simulation.check_recovered(open_storage);
+        });
+    }
+
+    // The time source and buffer callback of the handler point to the simulation
+    Simulation(const Simulation&) = delete;
+    auto operator=(const Simulation&) -> Simulation& = delete;
+    Simulation(Simulation&&) = delete;
+    auto operator=(Simulation&&) -> Simulation& = delete;
+    ~Simulation() = default;
+
+  private:
+    /// Key pressed by the simulated user, with what it types in the US layout
+    struct SimulatedKey
+    {
+        std::uint32_t key_code;
+        char plain;            ///< Typed without a modifier, '\0' if nothing
+        char shifted;          ///< Typed with Shift held, '\0' if nothing
+        ModifierMask modifier; ///< Modifier of a modifier key, 0 for other keys
+    };
+
+    static constexpr std::int64_t MIN_SCENARIO_HOURS = 6;
+    static constexpr std::int64_t MAX_SCENARIO_HOURS = 72;
+    static constexpr std::int64_t MAX_BURST_KEYS = 500;
+    static constexpr std::int64_t MIN_KEY_GAP_MS = 20;
+    static constexpr std::int64_t MAX_KEY_GAP_MS = 400;
+    static constexpr std::int64_t MAX_OUTAGE_SECONDS = 30 * 60;
+    static constexpr std::int64_t MAX_PARTITION_OUTAGE_HOURS = 4;
+    static constexpr double OUTAGE_CHANCE = 0.1;           ///< Per burst
+    static constexpr double PARTITION_OUTAGE_CHANCE = 0.5; ///< Per scenario
+    static constexpr double CHORD_CHANCE = 0.05;           ///< Per key press
+    static constexpr double LONE_MODIFIER_CHANCE = 0.02;   ///< Per key press
+    static constexpr double MAX_FAILURE_RATE = 0.05;       ///< Of writes outside of outages
+
+    /// Keys typed by the simulated user and the characters they type in the US layout
+    ///
+    /// Control characters like the one of Enter are not counted, so those keys type nothing.
+    static constexpr auto TYPED_KEYS = std::to_array<SimulatedKey>({
+      {KEY_A, 'a', 'A', 0},
+      {KEY_B, 'b', 'B', 0},
+      {KEY_C, 'c', 'C', 0},
+      {KEY_D, 'd', 'D', 0},
+      {KEY_E, 'e', 'E', 0},
+      {KEY_F, 'f', 'F', 0},
+      {KEY_G, 'g', 'G', 0},
+      {KEY_H, 'h', 'H', 0},
+      {KEY_I, 'i', 'I', 0},
+      {KEY_J, 'j', 'J', 0},
+      {KEY_K, 'k', 'K', 0},
+      {KEY_L, 'l', 'L', 0},
+      {KEY_M, 'm', 'M', 0},
+      {KEY_N, 'n', 'N', 0},
+      {KEY_O, 'o', 'O', 0},
+      {KEY_P, 'p', 'P', 0},
+      {KEY_Q, 'q', 'Q', 0},
+      {KEY_R, 'r', 'R', 0},
+      {KEY_S, 's', 'S', 0},
+      {KEY_T, 't', 'T', 0},
+      {KEY_U, 'u', 'U', 0},
+      {KEY_V, 'v', 'V', 0},
+      {KEY_W, 'w', 'W', 0},
+      {KEY_X, 'x', 'X', 0},
+      {KEY_Y, 'y', 'Y', 0},
+      {KEY_Z, 'z', 'Z', 0},
+      {KEY_1, '1', '!', 0},
+      {KEY_2, '2', '@', 0},
+      {KEY_3, '3', '#', 0},
+      {KEY_4, '4', '$', 0},
+      {KEY_5, '5', '%', 0},
+      {KEY_6, '6', '^', 0},
+      {KEY_7, '7', '&', 0},
+      {KEY_8, '8', '*', 0},
+      {KEY_9, '9', '(', 0},
+      {KEY_0, '0', ')', 0},
+      {KEY_MINUS, '-', '_', 0},
+      {KEY_EQUAL, '=', '+', 0},
+      {KEY_LEFTBRACE, '[', '{', 0},
+      {KEY_RIGHTBRACE, ']', '}', 0},
+      {KEY_SEMICOLON, ';', ':', 0},
+      {KEY_APOSTROPHE, '\'', '"', 0},
+      {KEY_GRAVE, '`', '~', 0},
+      {KEY_BACKSLASH, '\\', '|', 0},
+      {KEY_COMMA, ',', '<', 0},
+      {KEY_DOT, '.', '>', 0},
+      {KEY_SLASH, '/', '?', 0},
+      {KEY_SPACE, ' ', ' ', 0},
+      {KEY_ESC, '\0', '\0', 0},
+      {KEY_BACKSPACE, '\0', '\0', 0},
+      {KEY_TAB, '\0', '\0', 0},
+      {KEY_ENTER, '\0', '\0', 0},
+      {KEY_F1, '\0', '\0', 0},
+      {KEY_F2, '\0', '\0', 0},
+      {KEY_F5, '\0', '\0', 0},
+      {KEY_F12, '\0', '\0', 0},
+      {KEY_HOME, '\0', '\0', 0},
+      {KEY_END, '\0', '\0', 0},
+      {KEY_PAGEUP, '\0', '\0', 0},
+      {KEY_PAGEDOWN, '\0', '\0', 0},
+      {KEY_INSERT, '\0', '\0', 0},
+      {KEY_DELETE, '\0', '\0', 0},
+      {KEY_UP, '\0', '\0', 0},
+      {KEY_DOWN, '\0', '\0', 0},
+      {KEY_LEFT, '\0', '\0', 0},
+      {KEY_RIGHT, '\0', '\0', 0},
+      {KEY_MUTE, '\0', '\0', 0},
+      {KEY_VOLUMEUP, '\0', '\0', 0},
+    });
+
+    /// Modifier keys, the right Alt key is Alt in the US layout
+    static constexpr auto MODIFIER_KEYS = std::to_array<SimulatedKey>({
+      {KEY_LEFTSHIFT, '\0', '\0', MODIFIER_SHIFT},
+      {KEY_RIGHTSHIFT, '\0', '\0', MODIFIER_SHIFT},
+      {KEY_LEFTCTRL, '\0', '\0', MODIFIER_CTRL},
+      {KEY_RIGHTCTRL, '\0', '\0', MODIFIER_CTRL},
+      {KEY_LEFTALT, '\0', '\0', MODIFIER_ALT},
+      {KEY_RIGHTALT, '\0', '\0', MODIFIER_ALT},
+      {KEY_LEFTMETA, '\0', '\0', MODIFIER_SUPER},
+      {KEY_RIGHTMETA, '\0', '\0', MODIFIER_SUPER},
+    });
+
+    /// Large enough for every scan code on the few days a storage outage can span
+    static constexpr std::size_t BUFFER_CAPACITY = 1024;
+
+    /// Longest time a key press may stay unwritten while the storage is healthy
+    static constexpr auto DURABILITY_BOUND =
+      std::chrono::seconds(BUFFER_TIMEOUT) + std::chrono::milliseconds(POLL_TIMEOUT_MS);
+
+    Simulation(std::uint64_t seed, const KeymapCache* keymap)
+      : seed_(seed),
+        random_(seed),
+        keymap_(keymap),
+        handler_(EventHandler::create_detached({
+          .now = [this] -> Clock::time_point { return now_; },
+          .wall_now = [this] -> std::chrono::sys_seconds { return wall_now(); },
+          .today = [this] -> std::chrono::year_month_day { return today(); },
+        }))
+    {
+        wall_start_ = random_start();
+        abrupt_ = chance(0.5);
+        failure_rate_ = std::uniform_real_distribution<double>(0.0, MAX_FAILURE_RATE)(random_);
+
+        // A full disk shows when the partition of the next year is created, while the current one still works
+        if (chance(PARTITION_OUTAGE_CHANCE)) {
+            partition_outage_year_ = year_month_day_of(wall_start_).year() + std::chrono::years(1);
+            partition_outage_end_ = start_ + std::chrono::hours(uniform<std::int64_t>(1, MAX_PARTITION_OUTAGE_HOURS));
+        }
+
+        storage_.set_failure_injector([this](std::chrono::year year) -> bool {
+            return now_ < outage_end_ || (year >= partition_outage_year_ && now_ < partition_outage_end_)
+                || chance(failure_rate_);
+        });
+        handler_.set_buffer_callback(
+          [this](const common::FlushBatch& batch) -> std::expected<void, Error> { return commit(batch); });
+        if (chance(0.5)) {
+            handler_.set_buffer_capacity(BUFFER_CAPACITY);
+        }
+
+        if (keymap_ != nullptr) {
+            handler_.enable_character_tracking(*keymap_);
+        }
+    }
+
+    /// Runs scenarios with consecutive seeds and adds up their results
+    [[nodiscard]]
+    static auto run_scenarios(std::uint64_t seed,
+                              std::size_t scenarios,
+                              const std::function<void(Simulation&)>& run_one) -> SimulationReport
+    {
+        SimulationReport report;
+
+        // A fixed layout keeps the runs reproducible across machines
+        KeymapNames names;
+        names.layout = "us";
+        const auto keymap = KeymapCache::create(names);
+        report.characters_checked = keymap.has_value();
+
+        for (std::size_t i = 0; i < scenarios; ++i) {
+            Simulation simulation(seed + i, keymap ? &*keymap : nullptr);
+            run_one(simulation);
+
+            ++report.scenarios;
+            report.violations += simulation.violations_;
+            report.abrupt_terminations += simulation.abrupt_ ? 1 : 0;
+            report.key_presses += simulation.key_presses_;
+            report.failed_writes += simulation.failed_writes_;
+            report.simulated_time += simulation.now_ - simulation.start_;
+        }
+
+        return report;
+    }
+
+    /// Runs the scenario in a child process that also writes to the real storage engine
+    ///
+    /// The child starts from a copy of this simulation, so it draws the same random numbers as the
+    /// scenario run afterwards in this process. Its violations are reported by that run.
+    auto run_in_child(const StorageFactory& open_storage) -> void
+    {
+        const pid_t child = fork();
+        if (child < 0) {
+            violation(std::format("failed to fork the scenario: {}", std::strerror(errno)));
+            return;
+        }
+
+        if (child == 0) {
+            print_violations_ = false;
+
+            auto storage = open_storage();
+            if (!storage) {
+                std::_Exit(EXIT_FAILURE);
+            }
+
+            storage_.set_durable_storage(storage->get());
+            run_scenario();
+
+            // Nothing is closed or synced, like the backend being killed or the machine losing power
+            if (abrupt_) {
+                ::kill(::getpid(), SIGKILL);
+            }
+
+            storage->reset();
+            std::_Exit(EXIT_SUCCESS);
+        }
+
+        int status = 0;
+        while (waitpid(child, &status, 0) < 0) {
+            if (errno != EINTR) {
+                violation(std::format("failed to wait for the scenario: {}", std::strerror(errno)));
+                return;
+            }
+        }
+
+        const bool ended = abrupt_ ? WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL
+                                   : WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        if (!ended) {
+            violation("the scenario on the real storage did not end as planned");
+        }
+    }
+
+    /// Alternates bursts of typing with idle periods until the scenario ends
+    auto run_scenario() -> void
+    {
+        const auto end = now_ + std::chrono::hours(uniform<std::int64_t>(MIN_SCENARIO_HOURS, MAX_SCENARIO_HOURS));
+
+        while (now_ < end) {
+            if (chance(OUTAGE_CHANCE)) {
+                outage_end_ = now_ + std::chrono::seconds(uniform<std::int64_t>(1, MAX_OUTAGE_SECONDS));
+            }
+
+            type_burst(end);
+            idle(end);
+        }
+
+        // An abrupt termination drops the handler with whatever it buffered
+        if (abrupt_) {
+            return;
+        }
+
+        // A clean shutdown with a healthy storage must write everything
+        outage_end_ = now_;
+        partition_outage_end_ = now_;
+        failure_rate_ = 0.0;
+        handler_.finish();
+    }
+
+    /// Presses a run of keys, some of them with a modifier held
+    auto type_burst(Clock::time_point end) -> void
+    {
+        const auto keys = uniform<std::int64_t>(1, MAX_BURST_KEYS);
+
+        for (std::int64_t i = 0; i < keys; ++i) {
+            advance_to(std::min(end, now_ + std::chrono::milliseconds(uniform(MIN_KEY_GAP_MS, MAX_KEY_GAP_MS))));
+            if (now_ >= end) {
+                return;
+            }
+
+            const auto& key = chance(LONE_MODIFIER_CHANCE) ? random_key(MODIFIER_KEYS) : random_key(TYPED_KEYS);
+            if (key.modifier == 0 && chance(CHORD_CHANCE)) {
+                const auto& modifier = random_key(MODIFIER_KEYS);
+                press(modifier);
+                press(key);
+                release(key);
+                release(modifier);
+            } else {
+                press(key);
+                release(key);
+            }
+
+            handler_.tick();
+            check_durability();
+        }
+    }
+
+    /// Waits without typing, mostly briefly and sometimes for days
+    auto idle(Clock::time_point end) -> void
+    {
+        constexpr std::int64_t MINUTE = 60;
+        constexpr std::int64_t HOUR = 60 * MINUTE;
+        constexpr std::int64_t DAY = 24 * HOUR;
+
+        const auto kind = uniform<std::int64_t>(0, 99);
+        const auto seconds = kind < 70   ? uniform<std::int64_t>(1, 10 * MINUTE)
+                           : kind < 95 ? uniform<std::int64_t>(10 * MINUTE, 8 * HOUR)
+                                       : uniform<std::int64_t>(8 * HOUR, 7 * DAY);
+
+        advance_to(std::min(end, now_ + std::chrono::seconds(seconds)));
+    }
+
+    /// Advances the clock like the poll loop of the backend, which wakes up every POLL_TIMEOUT_MS
+    ///
+    /// While nothing is buffered the handler only closes idle sessions, which does not depend on
+    /// when it happens, so the clock jumps to the target right away.
+    auto advance_to(Clock::time_point target) -> void
+    {
+        while (now_ < target) {
+            now_ = handler_.buffered_events() == 0
+                   ? target
+                   : std::min(target, now_ + std::chrono::milliseconds(POLL_TIMEOUT_MS));
+
+            handler_.tick();
+            check_durability();
+        }
+    }
+
+    /// Passes a key press to the handler and remembers its events as not yet written
+    ///
+    /// The expected chord and character follow from the key table and the modifier the simulated
+    /// user holds, not from the modifier tracking or the keymap the handler uses.
+    auto press(const SimulatedKey& key) -> void
+    {
+        handler_.process_key(key.key_code, true, now_);
+
+        if (pending_.empty()) {
+            pending_since_ = now_;
+        }
+
+        const auto day = common::to_day_number(today());
+        ++pending_.keystrokes[{day, key.key_code}];
+        ++key_presses_;
+
+        if (key.modifier != 0) {
+            held_modifiers_ = static_cast<ModifierMask>(held_modifiers_ | key.modifier);
+            return;
+        }
+
+        if (held_modifiers_ != 0) {
+            ++pending_.chords[{day, held_modifiers_, key.key_code}];
+        }
+
+        // Shortcuts type nothing, Shift selects the second character
+        const char typed = held_modifiers_ == 0                ? key.plain
+                         : held_modifiers_ == MODIFIER_SHIFT ? key.shifted
+                                                             : '\0';
+        if (keymap_ != nullptr && typed != '\0') {
+            ++pending_.characters[{day, common::Character{typed}}];
+        }
+    }
+
+    /// Passes a key release to the handler
+    auto release(const SimulatedKey& key) -> void
+    {
+        handler_.process_key(key.key_code, false, now_);
+        held_modifiers_ = static_cast<ModifierMask>(held_modifiers_ & ~key.modifier);
+    }
+
+    /// Buffer callback of the handler, writes to the storage unless a failure is injected
+    ///
+    /// Flushes only happen between key presses, so every pending event of a committed year is written.
+    /// The years the storage committed count as written even if the batch failed as a whole, a handler
+    /// that passes them again is caught by the invariants.
+    auto commit(const common::FlushBatch& batch) -> std::expected<void, Error>
+    {
+        auto result = storage_.write(batch);
+        for (const auto year : storage_.committed_years()) {
+            pending_.move_year(year, written_);
+        }
+
+        if (!result) {
+            ++failed_writes_;
+            pending_failed_ = pending_failed_ || !pending_.empty();
+            return result;
+        }
+
+        if (pending_.empty()) {
+            pending_failed_ = false;
+        }
+        return {};
+    }
+
+    /// Reports key presses that stayed buffered for longer than the durability bound
+    auto check_durability() -> void
+    {
+        if (durability_violated_ || pending_.empty() || pending_failed_) {
+            return;
+        }
+
+        if (now_ - pending_since_ > DURABILITY_BOUND) {
+            durability_violated_ = true;
+            violation(std::format("key presses stayed unwritten for {}s with a healthy storage",
+                                  std::chrono::duration_cast<std::chrono::seconds>(now_ - pending_since_).count()));
+        }
+    }
+
+    /// Compares the storage with the events written by the handler
+    auto check_invariants() -> void
+    {
+        // Only the events pending at an abrupt termination may be missing
+        const auto& stored = storage_.counts();
+        check_stored("key presses", stored.keystrokes, written_.keystrokes);
+        check_stored("characters", stored.characters, written_.characters);
+        check_stored("chords", stored.chords, written_.chords);
+
+        std::uint64_t session_keys = 0;
+        for (const auto& session : storage_.sessions()) {
+            session_keys += session.key_count;
+        }
+        if (session_keys > key_presses_) {
+            violation(std::format("typing sessions hold {} keys, but {} were pressed", session_keys, key_presses_));
+        }
+
+        if (abrupt_) {
+            return;
+        }
+
+        if (!pending_.empty()) {
+            violation(std::format("{} key presses were lost at a clean shutdown", total(pending_.keystrokes)));
+        }
+
+        if (session_keys != key_presses_) {
+            violation(std::format("typing sessions hold {} of {} key presses", session_keys, key_presses_));
+        }
+
+        // Both ends of a session are truncated to seconds, so the gap may appear a bit shorter
+        const auto& sessions = storage_.sessions();
+        for (std::size_t i = 1; i < sessions.size(); ++i) {
+            if (sessions[i].start + std::chrono::seconds(2)
+                < sessions[i - 1].end + std::chrono::seconds(SESSION_IDLE_GAP)) {
+                violation("typing sessions overlap or are not separated by the idle gap");
+                break;
+            }
+        }
+    }
+
+    /// Reopens the real storage written by the child process and compares its daily key counts
+    auto check_recovered(const StorageFactory& open_storage) -> void
+    {
+        auto storage = open_storage();
+        if (!storage) {
+            violation(std::format("the real storage failed to reopen: {}", storage.error().message));
+            return;
+        }
+
+        std::map<std::int32_t, std::uint64_t> written;
+        for (const auto& [key, count] : written_.keystrokes) {
+            written[key.first] += count;
+        }
+
+        const auto counts = (*storage)->daily_counts(year_month_day_of(wall_start_), today());
+        if (!counts) {
+            violation(std::format("the {} storage failed to query: {}", (*storage)->name(), counts.error().message));
+            return;
+        }
+
+        std::map<std::int32_t, std::uint64_t> stored;
+        for (const auto& count : *counts) {
+            stored[common::to_day_number(count.date)] += count.total;
+        }
+
+        if (total(stored) != total(written)) {
+            violation(std::format("{} key presses were written to the {} storage, but {} were recovered",
+                                  total(written),
+                                  (*storage)->name(),
+                                  total(stored)));
+        } else if (stored != written) {
+            violation(std::format("the {} storage recovered key presses on the wrong day", (*storage)->name()));
+        }
+    }
+
+    /// Reports counts of one kind of event that differ between the storage and the written events
+    template<typename Counts>
+    auto check_stored(std::string_view kind, const Counts& stored, const Counts& written) -> void
+    {
+        const auto stored_total = total(stored);
+        const auto written_total = total(written);
+        if (stored_total != written_total) {
+            violation(std::format("{} {} were written, but {} are stored", written_total, kind, stored_total));
+        } else if (stored != written) {
+            violation(std::format("{} are stored on the wrong day or key", kind));
+        }
+    }
+
+    /// Returns the sum of all counts
+    template<typename Counts>
+    [[nodiscard]]
+    static auto total(const Counts& counts) -> std::uint64_t
+    {
+        std::uint64_t sum = 0;
+        for (const auto& [key, count] : counts) {
+            sum += count;
+        }
+        return sum;
+    }
+
+    /// Prints a broken invariant with the seed that reproduces it
+    auto violation(std::string_view message) -> void
+    {
+        ++violations_;
+        if (print_violations_) {
+            std::println(std::cerr, "Simulation seed {}: {}", seed_, message);
+        }
+    }
+
+    /// Returns a random key of a table
+    [[nodiscard]]
+    auto random_key(std::span<const SimulatedKey> keys) -> const SimulatedKey&
+    {
+        return keys[uniform<std::size_t>(0, keys.size() - 1)];
+    }
+
+    /// Returns a random wall clock start, a quarter of the scenarios start right before a new year
+    [[nodiscard]]
+    auto random_start() -> std::chrono::sys_seconds
+    {
+        using namespace std::chrono;
+
+        const auto year_start = sys_days{year{static_cast<int>(uniform<std::int64_t>(2020, 2040))} / January / 1};
+        if (chance(0.25)) {
+            return year_start - seconds(uniform<std::int64_t>(1, 2 * 60 * 60));
+        }
+        return year_start + days(uniform<std::int64_t>(0, 364)) + seconds(uniform<std::int64_t>(0, 24 * 60 * 60 - 1));
+    }
+
+    /// Simulated wall clock, the simulation counts days in UTC
+    [[nodiscard]]
+    auto wall_now() const -> std::chrono::sys_seconds
+    {
+        return wall_start_ + std::chrono::floor<std::chrono::seconds>(now_ - start_);
+    }
+
+    /// Simulated local date
+    [[nodiscard]]
+    auto today() const -> std::chrono::year_month_day
+    {
+        return year_month_day_of(wall_now());
+    }
+
+    /// Returns the date of a simulated wall clock time
+    [[nodiscard]]
+    static auto year_month_day_of(std::chrono::sys_seconds time) -> std::chrono::year_month_day
+    {
+        return std::chrono::year_month_day{std::chrono::floor<std::chrono::days>(time)};
+    }
+
+    /// Returns a uniformly distributed number between both bounds (inclusive)
+    template<typename T>
+    [[nodiscard]]
+    auto uniform(T min, T max) -> T
+    {
+        return std::uniform_int_distribution<T>(min, max)(random_);
+    }
+
+    /// Returns true with the given probability
+    [[nodiscard]]
+    auto chance(double probability) -> bool
+    {
+        return std::bernoulli_distribution(probability)(random_);
+    }
+
+    std::uint64_t seed_;
+    std::mt19937_64 random_;
+    const KeymapCache* keymap_; ///< Null if characters are not checked
+    bool abrupt_{false};
+    double failure_rate_{0.0};
+
+    // The monotonic clock starts at an arbitrary point, like CLOCK_MONOTONIC after boot
+    Clock::time_point start_{std::chrono::hours(1)};
+    Clock::time_point now_{start_};
+    Clock::time_point outage_end_{start_};
+    std::chrono::year partition_outage_year_{std::chrono::year::max()}; ///< Writes of this year and later fail
+    Clock::time_point partition_outage_end_{start_};
+    std::chrono::sys_seconds wall_start_;
+
+    SimulatedStorage storage_;
+    EventHandler handler_;
+    ModifierMask held_modifiers_{0}; ///< Modifiers held by the simulated user
+
+    SimulatedCounts pending_; ///< Pressed, but not yet written
+    SimulatedCounts written_; ///< Pressed and written
+    Clock::time_point pending_since_;
+    bool pending_failed_{false}; ///< A write failed since the oldest pending key press
+    bool durability_violated_{false};
+
+    std::uint64_t key_presses_{0};
+    std::uint64_t failed_writes_{0};
+    std::size_t violations_{0};
+    bool print_violations_{true};
+};
+
+} // namespace typetrace::backend
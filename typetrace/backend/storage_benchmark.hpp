@@ -0,0 +1,129 @@
+#pragma once
+
+#include "clock.hpp"
+#include "constants.hpp"
+#include "date.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+#include "storage_engine.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <libevdev-1.0/libevdev/libevdev.h>
+#include <linux/input-event-codes.h>
+#include <random>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Measurements of a storage engine on the synthetic history of the benchmark
+struct BenchmarkResult
+{
+    std::string_view engine;
+    std::chrono::duration<double, std::micro> write_per_batch{0};
+    std::uintmax_t file_bytes{0};
+
+    /// Median latency of the daily counts of the last week, the last year and the whole history
+    std::array<std::chrono::duration<double, std::milli>, 3> query_latency{};
+};
+
+/// Compares the write cost, file size and range query latency of the storage engines
+///
+/// Every engine is fed the same seeded history of BENCHMARK_DAYS days ending today, flushed in
+/// batches of BUFFER_SIZE key presses like the event handler does.
+class StorageBenchmark final
+{
+  public:
+    /// Writes the synthetic history into the storage and measures it, the storage keeps its files in the directory
+    [[nodiscard]]
+    static auto run(StorageEngine& storage, const std::filesystem::path& dir) -> std::expected<BenchmarkResult, Error>
+    {
+        BenchmarkResult result{
+          .engine = storage.name(), .write_per_batch = {}, .file_bytes = 0, .query_latency = {}};
+
+        const auto today = common::local_date();
+        const auto first_day = common::to_day_number(today) - static_cast<std::int32_t>(BENCHMARK_DAYS) + 1;
+
+        std::mt19937_64 random(SEED);
+        std::uniform_int_distribution<std::uint32_t> keys(KEY_ESC, KEY_SPACE);
+        std::vector<common::KeystrokeEvent> batch(BUFFER_SIZE);
+
+        Clock::duration write_time{0};
+        for (std::size_t day = 0; day < BENCHMARK_DAYS; ++day) {
+            const auto date = common::from_day_number(first_day + static_cast<std::int32_t>(day));
+
+            for (std::size_t flush = 0; flush < BENCHMARK_BATCHES_PER_DAY; ++flush) {
+                for (auto& event : batch) {
+                    event = keystroke(keys(random), date);
+                }
+
+                const auto started = Clock::now();
+                TRY(storage.write({.keystrokes = batch, .characters = {}, .chords = {}, .sessions = {}}));
+                write_time += Clock::now() - started;
+            }
+        }
+        result.write_per_batch = write_time / static_cast<double>(BENCHMARK_DAYS * BENCHMARK_BATCHES_PER_DAY);
+
+        std::error_code error;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(dir, error)) {
+            if (entry.is_regular_file(error)) {
+                result.file_bytes += entry.file_size(error);
+            }
+        }
+
+        const std::array<std::int32_t, 3> query_days = {7, 365, static_cast<std::int32_t>(BENCHMARK_DAYS)};
+        for (std::size_t i = 0; i < query_days.size(); ++i) {
+            const auto from = common::from_day_number(common::to_day_number(today) - query_days.at(i) + 1);
+            result.query_latency.at(i) = TRY(median_query_latency(storage, from, today));
+        }
+
+        return result;
+    }
+
+  private:
+    /// Fixed seed, so every engine and every run gets the same history
+    static constexpr std::uint64_t SEED = 0x7479706574726163;
+
+    /// Returns a single key press of the given scan code, named like the event handler names it
+    [[nodiscard]]
+    static auto keystroke(std::uint32_t key_code, std::chrono::year_month_day date) -> common::KeystrokeEvent
+    {
+        const auto* key_name = libevdev_event_code_get_name(EV_KEY, key_code);
+        return {.key_name = key_name != nullptr ? std::string_view(key_name) : std::string_view("UNKNOWN"),
+                .date = date,
+                .key_code = key_code,
+                .count = 1};
+    }
+
+    /// Runs a range query BENCHMARK_QUERY_RUNS times and returns its median latency
+    [[nodiscard]]
+    static auto median_query_latency(StorageEngine& storage,
+                                     std::chrono::year_month_day from,
+                                     std::chrono::year_month_day to)
+      -> std::expected<std::chrono::duration<double, std::milli>, Error>
+    {
+        std::vector<Clock::duration> latencies;
+        latencies.reserve(BENCHMARK_QUERY_RUNS);
+
+        for (std::size_t attempt = 0; attempt < BENCHMARK_QUERY_RUNS; ++attempt) {
+            const auto started = Clock::now();
+            if (const auto counts = storage.daily_counts(from, to); !counts) {
+                return std::unexpected(counts.error());
+            }
+            latencies.push_back(Clock::now() - started);
+        }
+
+        std::ranges::sort(latencies);
+        return latencies[latencies.size() / 2];
+    }
+};
+
+} // namespace typetrace::backend
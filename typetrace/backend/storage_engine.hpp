@@ -0,0 +1,65 @@
+#pragma once
+
+#include "errors.hpp"
+#include "types.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace typetrace::backend {
+
+/// Available storage engine implementations
+enum class StorageKind : std::uint8_t
+{
+    SQLITE,   ///< General purpose SQLite database (default)
+    COLUMNAR, ///< Native append-only, memory-mapped columnar store
+};
+
+/// Parses the name of a storage engine as given on the command line
+[[nodiscard]]
+inline auto parse_storage_kind(std::string_view name) -> std::optional<StorageKind>
+{
+    if (name == "sqlite") {
+        return StorageKind::SQLITE;
+    }
+    if (name == "columnar") {
+        return StorageKind::COLUMNAR;
+    }
+    return std::nullopt;
+}
+
+/// Interface for the persistence of keystroke counts
+class StorageEngine
+{
+  public:
+    StorageEngine(const StorageEngine&) = delete;
+    auto operator=(const StorageEngine&) -> StorageEngine& = delete;
+    virtual ~StorageEngine() = default;
+
+    /// Adds the counts of a batch of buffered events to the storage
+    ///
+    /// The event handler passes the events of a single year per batch and retries a failed batch
+    /// later, so a failed write has to leave the storage unchanged.
+    [[nodiscard]]
+    virtual auto write(const common::FlushBatch& batch) -> std::expected<void, Error> = 0;
+
+    /// Returns the total amount of key presses per day between two dates (inclusive), ordered by date
+    [[nodiscard]]
+    virtual auto daily_counts(std::chrono::year_month_day from, std::chrono::year_month_day to)
+      -> std::expected<std::vector<common::DailyCount>, Error> = 0;
+
+    /// Returns the name of the storage engine
+    [[nodiscard]]
+    virtual auto name() const -> std::string_view = 0;
+
+  protected:
+    StorageEngine() = default;
+    StorageEngine(StorageEngine&&) = default;
+    auto operator=(StorageEngine&&) -> StorageEngine& = default;
+};
+
+} // namespace typetrace::backend
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "clock.hpp"
+#include "date.hpp"
+
+#include <chrono>
+#include <functional>
+
+namespace typetrace::backend {
+
+/// The clocks the event handler reads, the simulation replaces them with simulated ones
+struct TimeSource
+{
+    /// Monotonic time used for flush timeouts and typing sessions
+    std::function<Clock::time_point()> now = [] -> Clock::time_point { return Clock::now(); };
+
+    /// Wall clock time used for the start of typing sessions
+    std::function<std::chrono::sys_seconds()> wall_now = [] -> std::chrono::sys_seconds {
+        return std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+    };
+
+    /// Local date the key presses are counted on
+    std::function<std::chrono::year_month_day()> today = [] -> std::chrono::year_month_day {
+        return common::local_date();
+    };
+};
+
+} // namespace typetrace::backend
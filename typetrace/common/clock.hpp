@@ -0,0 +1,10 @@
+#pragma once
+
+#include <chrono>
+
+namespace typetrace {
+
+/// Monotonic clock for timeouts and durations, libinput event times are taken from the same clock
+using Clock = std::chrono::steady_clock;
+
+} // namespace typetrace
@@ -18,6 +18,29 @@ constexpr std::size_t BUFFER_TIMEOUT = 100;
 /// Polling timeout in milliseconds for libinput events
 constexpr std::size_t POLL_TIMEOUT_MS = 100;
 
+// ============================================================================
+// Typing Session Constants
+// ============================================================================
+
+/// Time (in seconds) without a key press after which a typing session ends
+constexpr std::size_t SESSION_IDLE_GAP = 120;
+
+/// Length (in seconds) of the sliding window the typing rate is measured over
+constexpr std::size_t SESSION_RATE_WINDOW = 60;
+
+/// Key presses counted as one word when the typing speed is given in words per minute
+constexpr std::size_t KEYS_PER_WORD = 5;
+
+// ============================================================================
+// Memory Budget Constants
+// ============================================================================
+
+/// Smallest memory budget (in MiB) the backend accepts
+constexpr std::size_t MIN_MEMORY_BUDGET_MIB = 2;
+
+/// Time (in seconds) between two memory usage reports in memory budget mode
+constexpr std::size_t MEMORY_REPORT_INTERVAL = 600;
+
 // ============================================================================
 // File and Directory Constants
 // ============================================================================
@@ -27,8 +50,79 @@ constexpr std::size_t POLL_TIMEOUT_MS = 100;
 /// The directory name
 constexpr std::string_view PROJECT_DIR_NAME = "typetrace";
 
-/// SQLite database file name
-constexpr std::string_view DB_FILE_NAME = "TypeTrace.db";
+/// SQLite database partition file name prefix, followed by the year of the partition
+constexpr std::string_view DB_PARTITION_PREFIX = "TypeTrace-";
+
+/// SQLite database file extension
+constexpr std::string_view DB_FILE_EXTENSION = ".db";
+
+/// Columnar store file name
+constexpr std::string_view COLUMN_STORE_FILE_NAME = "TypeTrace.cols";
+
+/// Directory name of the database backups, inside the database directory
+constexpr std::string_view BACKUP_DIR_NAME = "backups";
+
+/// File name of the cached summary of the frontend, inside the cache directory
+constexpr std::string_view SUMMARY_CACHE_FILE_NAME = "summary";
+
+// ============================================================================
+// Backup Constants
+// ============================================================================
+
+/// Number of database pages copied per online backup step
+constexpr int BACKUP_STEP_PAGES = 64;
+
+/// Time (in hours) between two scheduled backups
+constexpr std::size_t BACKUP_INTERVAL_HOURS = 24;
+
+/// Number of backups kept by the rotation
+constexpr std::size_t BACKUP_KEEP_COUNT = 7;
+
+// ============================================================================
+// IPC Constants
+// ============================================================================
+
+/// File name of the backend socket, inside the runtime directory
+constexpr std::string_view IPC_SOCKET_NAME = "typetrace.sock";
+
+/// Maximum number of simultaneous IPC clients
+constexpr std::size_t IPC_MAX_CONNECTIONS = 8;
+
+/// Unsent data (in bytes) after which a client that does not read is disconnected
+constexpr std::size_t IPC_MAX_PENDING_BYTES = 1024 * 1024;
+
+/// Minimum time (in milliseconds) between two live updates to subscribers
+constexpr std::size_t IPC_UPDATE_INTERVAL_MS = 250;
+
+// ============================================================================
+// Columnar Store Constants
+// ============================================================================
+
+/// Number of day blocks the columnar store file grows by when it is full
+constexpr std::size_t COLUMN_STORE_GROWTH_BLOCKS = 32;
+
+// ============================================================================
+// Simulation Constants
+// ============================================================================
+
+/// Number of seeded scenarios run by the simulation mode
+constexpr std::size_t SIMULATION_SCENARIOS = 200;
+
+/// Number of the seeded scenarios that are also run against the real storage engine and its recovery
+constexpr std::size_t SIMULATION_STORAGE_SCENARIOS = 20;
+
+// ============================================================================
+// Benchmark Constants
+// ============================================================================
+
+/// Number of days of synthetic history written by the storage benchmark
+constexpr std::size_t BENCHMARK_DAYS = 730;
+
+/// Number of flushes per day of the storage benchmark, each holding BUFFER_SIZE key presses
+constexpr std::size_t BENCHMARK_BATCHES_PER_DAY = 20;
+
+/// Number of runs of each range query of the storage benchmark, the median is reported
+constexpr std::size_t BENCHMARK_QUERY_RUNS = 25;
 
 } // namespace typetrace
 
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace typetrace::common {
+
+/// Returns the current date in the local time zone
+[[nodiscard]]
+inline auto local_date() -> std::chrono::year_month_day
+{
+    const std::time_t now = std::time(nullptr);
+    std::tm local{};
+    localtime_r(&now, &local);
+
+    return std::chrono::year_month_day{std::chrono::year{local.tm_year + 1900},
+                                       std::chrono::month{static_cast<unsigned int>(local.tm_mon + 1)},
+                                       std::chrono::day{static_cast<unsigned int>(local.tm_mday)}};
+}
+
+/// Formats a date as stored in the database (YYYY-MM-DD)
+[[nodiscard]]
+inline auto format_date(std::chrono::year_month_day date) -> std::string
+{
+    return std::format("{:%F}", date);
+}
+
+/// Parses a date as stored in the database (YYYY-MM-DD)
+[[nodiscard]]
+inline auto parse_date(std::string_view text) -> std::optional<std::chrono::year_month_day>
+{
+    constexpr std::size_t DATE_LENGTH = 10;
+    if (text.size() != DATE_LENGTH || text[4] != '-' || text[7] != '-') {
+        return std::nullopt;
+    }
+
+    const auto parse_number = [text](std::size_t offset, std::size_t length) -> std::optional<int> {
+        int value = 0;
+        const auto* const first = text.data() + offset;
+        const auto [ptr, ec] = std::from_chars(first, first + length, value);
+        if (ec != std::errc{} || ptr != first + length) {
+            return std::nullopt;
+        }
+        return value;
+    };
+
+    const auto year = parse_number(0, 4);
+    const auto month = parse_number(5, 2);
+    const auto day = parse_number(8, 2);
+    if (!year || !month || !day) {
+        return std::nullopt;
+    }
+
+    const std::chrono::year_month_day date{std::chrono::year{*year},
+                                           std::chrono::month{static_cast<unsigned int>(*month)},
+                                           std::chrono::day{static_cast<unsigned int>(*day)}};
+    if (!date.ok()) {
+        return std::nullopt;
+    }
+    return date;
+}
+
+/// Returns the number of days since the unix epoch for the given date
+[[nodiscard]]
+inline auto to_day_number(std::chrono::year_month_day date) -> std::int32_t
+{
+    return static_cast<std::int32_t>(std::chrono::sys_days{date}.time_since_epoch().count());
+}
+
+/// Returns the date for the given number of days since the unix epoch
+[[nodiscard]]
+inline auto from_day_number(std::int32_t day_number) -> std::chrono::year_month_day
+{
+    return std::chrono::year_month_day{std::chrono::sys_days{std::chrono::days{day_number}}};
+}
+
+} // namespace typetrace::common
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "constants.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <span>
+#include <sys/stat.h>
+#include <system_error>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace typetrace::common::ipc {
+
+// ============================================================================
+// Framing
+// ============================================================================
+//
+// Every message is a FrameHeader followed by payload_size bytes of payload. Both ends run on
+// the same host, so headers and payload structs are sent in native byte order.
+//
+// Requests carry an id chosen by the client. The backend answers them in order with a reply
+// carrying the same id, so a client can send several requests without waiting (pipelining).
+// Live updates carry the id of the SUBSCRIBE request that started them.
+
+/// Message types of the protocol
+enum class MessageType : std::uint8_t
+{
+    // Requests
+    FLUSH = 0x01,         ///< Write the buffered events to the storage
+    STATS = 0x02,         ///< Get the runtime statistics of the backend
+    RELOAD_CONFIG = 0x03, ///< Apply a ConfigMessage
+    SUBSCRIBE = 0x04,     ///< Receive live UPDATE messages
+    UNSUBSCRIBE = 0x05,   ///< Stop the live updates
+    STOP = 0x06,          ///< Flush and shut down the backend
+
+    // Replies and notifications
+    REPLY_OK = 0x80,    ///< Request succeeded, no payload
+    REPLY_ERROR = 0x81, ///< Request failed, the payload is the error message
+    REPLY_STATS = 0x82, ///< Reply to STATS, the payload is a StatsMessage
+    UPDATE = 0x83,      ///< Live update, the payload is an UpdateMessage followed by its KeyDeltas
+};
+
+struct FrameHeader
+{
+    std::uint32_t payload_size{0};
+    std::uint32_t request_id{0};
+    MessageType type{MessageType::REPLY_OK};
+    std::array<std::uint8_t, 3> reserved{};
+};
+
+static_assert(sizeof(FrameHeader) == 12);
+
+/// Largest payload accepted, larger frames are a protocol error
+constexpr std::uint32_t MAX_PAYLOAD_SIZE = 64 * 1024;
+
+// ============================================================================
+// Payloads
+// ============================================================================
+
+/// Runtime statistics of the backend
+struct StatsMessage
+{
+    std::uint64_t uptime_seconds{0};
+    std::uint64_t keys_pressed{0};    ///< Since the backend started
+    std::uint64_t buffered_events{0}; ///< Not yet written to the storage
+    std::uint64_t flushes{0};
+};
+
+static_assert(sizeof(StatsMessage) == 32);
+
+/// Runtime configuration applied by RELOAD_CONFIG
+struct ConfigMessage
+{
+    std::uint8_t log_level{0}; ///< spdlog level, from 0 (trace) to 6 (off)
+};
+
+/// Key presses since the previous update, coalesced per key
+struct UpdateMessage
+{
+    std::uint64_t keys_pressed{0}; ///< Total since the backend started
+    std::uint32_t delta_count{0};  ///< Number of KeyDelta entries following this header
+    std::uint32_t reserved{0};
+};
+
+static_assert(sizeof(UpdateMessage) == 16);
+
+struct KeyDelta
+{
+    std::uint32_t key_code{0};
+    std::uint32_t count{0};
+};
+
+// ============================================================================
+// Encoding
+// ============================================================================
+
+/// Result of looking for a frame at the start of received data
+enum class FrameStatus : std::uint8_t
+{
+    COMPLETE,   ///< A whole frame is available
+    INCOMPLETE, ///< More data is needed
+    INVALID,    ///< The frame exceeds MAX_PAYLOAD_SIZE
+};
+
+struct Frame
+{
+    FrameStatus status{FrameStatus::INCOMPLETE};
+    FrameHeader header;
+    std::span<const std::byte> payload;
+    std::size_t size{0}; ///< Bytes taken by the frame, including the header
+};
+
+/// Returns the frame at the start of the received data, if it is complete
+[[nodiscard]]
+inline auto next_frame(std::span<const std::byte> input) -> Frame
+{
+    Frame frame;
+    if (input.size() < sizeof(FrameHeader)) {
+        return frame;
+    }
+
+    std::memcpy(&frame.header, input.data(), sizeof(FrameHeader));
+    if (frame.header.payload_size > MAX_PAYLOAD_SIZE) {
+        frame.status = FrameStatus::INVALID;
+        return frame;
+    }
+    if (input.size() - sizeof(FrameHeader) < frame.header.payload_size) {
+        return frame;
+    }
+
+    frame.status = FrameStatus::COMPLETE;
+    frame.payload = input.subspan(sizeof(FrameHeader), frame.header.payload_size);
+    frame.size = sizeof(FrameHeader) + frame.header.payload_size;
+    return frame;
+}
+
+/// Appends a frame to a send buffer
+inline auto append_frame(std::vector<std::byte>& output,
+                         MessageType type,
+                         std::uint32_t request_id,
+                         std::span<const std::byte> payload = {}) -> void
+{
+    const FrameHeader header{
+      .payload_size = static_cast<std::uint32_t>(payload.size()),
+      .request_id = request_id,
+      .type = type,
+      .reserved = {},
+    };
+
+    const auto header_bytes = std::as_bytes(std::span(&header, 1));
+    output.insert(output.end(), header_bytes.begin(), header_bytes.end());
+    output.insert(output.end(), payload.begin(), payload.end());
+}
+
+/// Returns the bytes of a payload struct
+template<typename Payload>
+[[nodiscard]]
+auto payload_bytes(const Payload& payload) -> std::span<const std::byte>
+{
+    static_assert(std::is_trivially_copyable_v<Payload>);
+    return std::as_bytes(std::span(&payload, 1));
+}
+
+/// Reads a payload struct at the given offset, if the payload is large enough
+template<typename Payload>
+[[nodiscard]]
+auto read_payload(std::span<const std::byte> payload, std::size_t offset = 0) -> std::optional<Payload>
+{
+    static_assert(std::is_trivially_copyable_v<Payload>);
+    if (offset > payload.size() || payload.size() - offset < sizeof(Payload)) {
+        return std::nullopt;
+    }
+
+    Payload value{};
+    std::memcpy(&value, payload.data() + offset, sizeof(Payload));
+    return value;
+}
+
+// ============================================================================
+// Socket
+// ============================================================================
+
+/// Owning handle of a socket file descriptor
+class Socket final
+{
+  public:
+    Socket() = default;
+    explicit Socket(int fd) : fd_(fd) {}
+
+    Socket(const Socket&) = delete;
+    auto operator=(const Socket&) -> Socket& = delete;
+
+    Socket(Socket&& other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+
+    auto operator=(Socket&& other) noexcept -> Socket&
+    {
+        if (this != &other) {
+            reset(std::exchange(other.fd_, -1));
+        }
+        return *this;
+    }
+
+    ~Socket()
+    {
+        reset();
+    }
+
+    /// Closes the owned descriptor and takes over the given one
+    auto reset(int fd = -1) -> void
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = fd;
+    }
+
+    [[nodiscard]]
+    auto get() const -> int
+    {
+        return fd_;
+    }
+
+    [[nodiscard]]
+    explicit operator bool() const
+    {
+        return fd_ >= 0;
+    }
+
+  private:
+    int fd_{-1};
+};
+
+/// Returns the path of the backend socket, in a directory only the user can access
+///
+/// That is the runtime directory of the user if one is set. Otherwise it is a directory of the
+/// user in the temporary directory, which is refused if it belongs to someone else or others
+/// have access to it, e.g. because another user created it first.
+[[nodiscard]]
+inline auto socket_path() -> std::optional<std::filesystem::path>
+{
+    if (const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR"); runtime_dir != nullptr && *runtime_dir != '\0') {
+        return std::filesystem::path(runtime_dir) / IPC_SOCKET_NAME;
+    }
+
+    std::error_code error;
+    const auto dir = std::filesystem::temp_directory_path(error) / std::format("typetrace-{}", getuid());
+    if (error || (::mkdir(dir.c_str(), S_IRWXU) < 0 && errno != EEXIST)) {
+        return std::nullopt;
+    }
+
+    struct stat dir_stat{};
+    if (::lstat(dir.c_str(), &dir_stat) < 0 || !S_ISDIR(dir_stat.st_mode) || dir_stat.st_uid != getuid()
+        || (dir_stat.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+        return std::nullopt;
+    }
+    return dir / IPC_SOCKET_NAME;
+}
+
+} // namespace typetrace::common::ipc
@@ -72,6 +72,17 @@ class Logger final
         SPDLOG_LOGGER_CRITICAL(logger_, fmt, std::forward<Args>(args)...);
     }
 
+    /// Changes the minimum level of logged messages at runtime
+    ///
+    /// Messages below SPDLOG_ACTIVE_LEVEL are compiled out and stay disabled.
+    auto set_level(spdlog::level::level_enum level) -> void
+    {
+        for (const auto& sink : logger_->sinks()) {
+            sink->set_level(level);
+        }
+        logger_->set_level(level);
+    }
+
   private:
     std::shared_ptr<spdlog::logger> logger_;
 
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "date.hpp"
+#include "errors.hpp"
+#include "macros.hpp"
+#include "partitions.hpp"
+#include "sql.hpp"
+#include "types.hpp"
+
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Exception.h>
+#include <SQLiteCpp/Statement.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace typetrace::common {
+
+/// Reads per-day statistics from the yearly database partitions
+///
+/// The partitions that overlap the requested range are attached read-only to an in-memory
+/// connection and queried as one union, so the backend and the frontend read them the same way
+/// and neither disturbs the partition being written.
+class PartitionReader final
+{
+  public:
+    /// Returns the total amount of key presses per day between two dates (inclusive)
+    [[nodiscard]]
+    static auto daily_counts(const std::filesystem::path& db_dir,
+                             std::chrono::year_month_day from,
+                             std::chrono::year_month_day to) -> std::expected<std::vector<DailyCount>, Error>
+    {
+        std::vector<DailyCount> counts;
+
+        TRY(query_range(db_dir,
+                        from,
+                        to,
+                        {.table = "keystrokes",
+                         .rows = PARTITION_KEYSTROKES_SQL,
+                         .aggregate = GET_PARTITIONED_DAILY_COUNTS_SQL,
+                         .description = "daily counts"},
+                        [&counts](const SQLite::Statement& stmt, std::chrono::year_month_day date) -> void {
+                            counts.push_back(
+                              {.date = date, .total = static_cast<std::uint64_t>(stmt.getColumn(1).getInt64())});
+                        }));
+
+        return counts;
+    }
+
+    /// Returns the typing sessions per day between two dates (inclusive)
+    ///
+    /// Partitions written before sessions were tracked have no sessions table and are skipped.
+    [[nodiscard]]
+    static auto daily_sessions(const std::filesystem::path& db_dir,
+                               std::chrono::year_month_day from,
+                               std::chrono::year_month_day to) -> std::expected<std::vector<DailySessions>, Error>
+    {
+        std::vector<DailySessions> sessions;
+
+        TRY(query_range(db_dir,
+                        from,
+                        to,
+                        {.table = "sessions",
+                         .rows = PARTITION_SESSIONS_SQL,
+                         .aggregate = GET_PARTITIONED_DAILY_SESSIONS_SQL,
+                         .description = "daily sessions"},
+                        [&sessions](const SQLite::Statement& stmt, std::chrono::year_month_day date) -> void {
+                            sessions.push_back(
+                              {.date = date,
+                               .sessions = static_cast<std::uint32_t>(stmt.getColumn(1).getInt64()),
+                               .typing_seconds = static_cast<std::uint64_t>(stmt.getColumn(2).getInt64()),
+                               .key_count = static_cast<std::uint64_t>(stmt.getColumn(3).getInt64()),
+                               .peak_keys_per_minute = static_cast<std::uint32_t>(stmt.getColumn(4).getInt64())});
+                        }));
+
+        return sessions;
+    }
+
+  private:
+    /// Maximum amount of partitions attached to a single query connection
+    static constexpr std::size_t MAX_ATTACHED_PARTITIONS = 8;
+
+    /// Per-day query over one table of all partitions in a date range
+    struct PartitionQuery
+    {
+        std::string_view table;       ///< Table the rows are selected from
+        std::string_view rows;        ///< Rows of one attached partition in the range, formatted with its number
+        std::string_view aggregate;   ///< Per-day query, formatted with the union of the rows
+        std::string_view description; ///< What is queried, used in error messages
+    };
+
+    /// Called for each day a query returns, with the statement positioned on its row
+    using RowReader = std::function<void(const SQLite::Statement&, std::chrono::year_month_day)>;
+
+    /// Runs a per-day query over the partitions that overlap the range
+    [[nodiscard]]
+    static auto query_range(const std::filesystem::path& db_dir,
+                            std::chrono::year_month_day from,
+                            std::chrono::year_month_day to,
+                            const PartitionQuery& query,
+                            const RowReader& read_row) -> std::expected<void, Error>
+    {
+        const auto partitions = partitions_between(db_dir, from, to);
+
+        try {
+            SQLite::Database reader(":memory:",
+                                    static_cast<unsigned int>(SQLite::OPEN_READWRITE)
+                                      | static_cast<unsigned int>(SQLite::OPEN_URI));
+
+            // SQLite limits the amount of attached databases, so query the partitions in chunks
+            for (std::size_t first = 0; first < partitions.size(); first += MAX_ATTACHED_PARTITIONS) {
+                const auto chunk = std::span(partitions).subspan(
+                  first, std::min(MAX_ATTACHED_PARTITIONS, partitions.size() - first));
+                query_partitions(reader, chunk, query, from, to, read_row);
+            }
+        }
+        catch (const SQLite::Exception& e) {
+            return std::unexpected(
+              make_database_error(std::format("Failed to query {}: {}", query.description, e.what())));
+        }
+
+        return {};
+    }
+
+    /// Attaches the given partitions read-only and reads the days of the query in the range
+    ///
+    /// Partitions lacking the queried table are left out of the union.
+    static auto query_partitions(SQLite::Database& reader,
+                                 std::span<const std::filesystem::path> partitions,
+                                 const PartitionQuery& query,
+                                 std::chrono::year_month_day from,
+                                 std::chrono::year_month_day to,
+                                 const RowReader& read_row) -> void
+    {
+        std::string rows;
+        for (std::size_t i = 0; i < partitions.size(); ++i) {
+            SQLite::Statement attach(reader, ATTACH_PARTITION_SQL);
+            attach.bind(1, read_only_uri(partitions[i]));
+            attach.bind(2, std::format("partition_{}", i));
+            attach.exec();
+
+            SQLite::Statement has_table(reader, std::format(PARTITION_HAS_TABLE_SQL, i));
+            has_table.bind(1, std::string(query.table));
+            if (!has_table.executeStep()) {
+                continue;
+            }
+
+            if (!rows.empty()) {
+                rows += " UNION ALL ";
+            }
+            rows += std::vformat(query.rows, std::make_format_args(i));
+        }
+
+        if (!rows.empty()) {
+            SQLite::Statement stmt(reader, std::vformat(query.aggregate, std::make_format_args(rows)));
+            stmt.bind(1, format_date(from));
+            stmt.bind(2, format_date(to));
+
+            while (stmt.executeStep()) {
+                if (const auto date = parse_date(stmt.getColumn(0).getString())) {
+                    read_row(stmt, *date);
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < partitions.size(); ++i) {
+            SQLite::Statement detach(reader, DETACH_PARTITION_SQL);
+            detach.bind(1, std::format("partition_{}", i));
+            detach.exec();
+        }
+    }
+
+    /// Returns a read-only SQLite URI for the given database file
+    [[nodiscard]]
+    static auto read_only_uri(const std::filesystem::path& file) -> std::string
+    {
+        std::string uri = "file:";
+        for (const char character : file.string()) {
+            switch (character) {
+                case '%': uri += "%25"; break;
+                case '?': uri += "%3f"; break;
+                case '#': uri += "%23"; break;
+                default:  uri += character; break;
+            }
+        }
+        return uri + "?mode=ro";
+    }
+};
+
+} // namespace typetrace::common
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "constants.hpp"
+#include "version.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace typetrace::common {
+
+/// Returns the directory the database partitions are stored in, or nothing if HOME is not set
+[[nodiscard]]
+inline auto database_dir() -> std::optional<std::filesystem::path>
+{
+    const char* home = std::getenv("HOME");
+    if (home == nullptr) {
+        return std::nullopt;
+    }
+    return std::filesystem::path(home) / ".local" / "share" / PROJECT_NAME;
+}
+
+/// Returns the file of the partition for the given year
+[[nodiscard]]
+inline auto partition_file(const std::filesystem::path& db_dir, int year) -> std::filesystem::path
+{
+    return db_dir / std::format("{}{}{}", DB_PARTITION_PREFIX, year, DB_FILE_EXTENSION);
+}
+
+/// Returns the year of a partition file, or nothing if the file is not a partition
+[[nodiscard]]
+inline auto partition_year(const std::filesystem::path& file) -> std::optional<int>
+{
+    const auto file_name = file.filename().string();
+    if (!file_name.starts_with(DB_PARTITION_PREFIX) || !file_name.ends_with(DB_FILE_EXTENSION)) {
+        return std::nullopt;
+    }
+
+    const auto year_text = std::string_view(file_name).substr(
+      DB_PARTITION_PREFIX.size(), file_name.size() - DB_PARTITION_PREFIX.size() - DB_FILE_EXTENSION.size());
+
+    int year = 0;
+    const auto [ptr, ec] = std::from_chars(year_text.data(), year_text.data() + year_text.size(), year);
+    if (ec != std::errc{} || ptr != year_text.data() + year_text.size()) {
+        return std::nullopt;
+    }
+    return year;
+}
+
+/// Returns all partition files in the given directory, ordered by year
+[[nodiscard]]
+inline auto partitions(const std::filesystem::path& db_dir) -> std::vector<std::filesystem::path>
+{
+    std::vector<std::filesystem::path> files;
+
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(db_dir, error)) {
+        if (partition_year(entry.path())) {
+            files.push_back(entry.path());
+        }
+    }
+
+    std::ranges::sort(files);
+    return files;
+}
+
+/// Returns the existing partition files that may hold days between two dates, ordered by year
+[[nodiscard]]
+inline auto partitions_between(const std::filesystem::path& db_dir,
+                               std::chrono::year_month_day from,
+                               std::chrono::year_month_day to) -> std::vector<std::filesystem::path>
+{
+    std::vector<std::filesystem::path> files;
+
+    std::error_code error;
+    for (auto year = static_cast<int>(from.year()); year <= static_cast<int>(to.year()); ++year) {
+        if (auto file = partition_file(db_dir, year); std::filesystem::exists(file, error)) {
+            files.push_back(std::move(file));
+        }
+    }
+
+    return files;
+}
+
+} // namespace typetrace::common
@@ -17,6 +17,72 @@ constexpr const char* CREATE_KEYSTROKES_TABLE_SQL = {
            UNIQUE(scan_code, date)
        );)"};
 
+/// SQL query to create the characters table if it doesn't exist
+constexpr const char* CREATE_CHARACTERS_TABLE_SQL = {
+  R"(CREATE TABLE IF NOT EXISTS characters (
+           id INTEGER PRIMARY KEY AUTOINCREMENT,
+           character TEXT NOT NULL,
+           date DATE NOT NULL,
+           count INTEGER DEFAULT 0,
+           UNIQUE(character, date)
+       );)"};
+
+/// SQL query to create the modifier chords table if it doesn't exist
+constexpr const char* CREATE_CHORDS_TABLE_SQL = {
+  R"(CREATE TABLE IF NOT EXISTS chords (
+           id INTEGER PRIMARY KEY AUTOINCREMENT,
+           modifiers INTEGER NOT NULL,
+           scan_code INTEGER NOT NULL,
+           date DATE NOT NULL,
+           count INTEGER DEFAULT 0,
+           UNIQUE(modifiers, scan_code, date)
+       );)"};
+
+/// SQL query to create the typing sessions table if it doesn't exist, times are Unix timestamps
+constexpr const char* CREATE_SESSIONS_TABLE_SQL = {
+  R"(CREATE TABLE IF NOT EXISTS sessions (
+           id INTEGER PRIMARY KEY AUTOINCREMENT,
+           date DATE NOT NULL,
+           start INTEGER NOT NULL,
+           end INTEGER NOT NULL,
+           key_count INTEGER NOT NULL,
+           peak_rate INTEGER NOT NULL
+       );)"};
+
+/// SQL query to index the typing sessions by date, used by the daily session statistics
+constexpr const char* CREATE_SESSIONS_DATE_INDEX_SQL = {
+  R"(CREATE INDEX IF NOT EXISTS sessions_date ON sessions (date);)"};
+
+/// SQL query to index the keystrokes in (date, scan_code) order, used by range queries and merges
+constexpr const char* CREATE_KEYSTROKES_DATE_INDEX_SQL = {
+  R"(CREATE INDEX IF NOT EXISTS keystrokes_date_scan_code ON keystrokes (date, scan_code);)"};
+
+/// SQL query to create the metadata table if it doesn't exist
+constexpr const char* CREATE_METADATA_TABLE_SQL = {
+  R"(CREATE TABLE IF NOT EXISTS metadata (
+           key TEXT PRIMARY KEY,
+           value TEXT NOT NULL
+       );)"};
+
+/// SQL query to create the table of merged per-origin counts if it doesn't exist
+constexpr const char* CREATE_ORIGIN_COUNTS_TABLE_SQL = {
+  R"(CREATE TABLE IF NOT EXISTS origin_counts (
+           date DATE NOT NULL,
+           scan_code INTEGER NOT NULL,
+           origin TEXT NOT NULL,
+           key_name TEXT NOT NULL,
+           count INTEGER NOT NULL,
+           PRIMARY KEY(date, scan_code, origin)
+       ) WITHOUT ROWID;)"};
+
+/// SQL query to record the origin of the local keystroke counts, keeps an existing origin
+constexpr const char* SET_ORIGIN_SQL = {R"(INSERT OR IGNORE INTO metadata (key, value) VALUES ('origin', ?);)"};
+
+/// SQL query to insert a merged per-origin count
+constexpr const char* INSERT_ORIGIN_COUNT_SQL = {
+  R"(INSERT INTO origin_counts (date, scan_code, origin, key_name, count)
+       VALUES (?, ?, ?, ?, ?);)"};
+
 /// Database optimization pragmas
 constexpr const char* OPTIMIZE_DATABASE_SQL =
   R"(PRAGMA journal_mode=WAL;
@@ -24,14 +90,51 @@ constexpr const char* OPTIMIZE_DATABASE_SQL =
        PRAGMA cache_size=10000;
        PRAGMA temp_store=memory;)";
 
+/// Limits the page cache of a connection, the placeholder is the size in KiB
+constexpr const char* SET_CACHE_SIZE_SQL = "PRAGMA cache_size=-{};";
+
 /// SQL query for inserting or updating keystroke data (UPSERT)
 constexpr const char* UPSERT_KEYSTROKE_SQL = {
   R"(INSERT INTO keystrokes (scan_code, key_name, date, count)
-       VALUES (?, ?, ?, 1)
+       VALUES (?, ?, ?, ?)
        ON CONFLICT(scan_code, date) DO UPDATE SET
-           count = count + 1,
+           count = count + excluded.count,
            key_name = excluded.key_name;)"};
 
+/// SQL query for inserting or updating character counts (UPSERT)
+constexpr const char* UPSERT_CHARACTER_SQL = {
+  R"(INSERT INTO characters (character, date, count)
+       VALUES (?, ?, ?)
+       ON CONFLICT(character, date) DO UPDATE SET
+           count = count + excluded.count;)"};
+
+/// SQL query for inserting or updating chord counts (UPSERT)
+constexpr const char* UPSERT_CHORD_SQL = {
+  R"(INSERT INTO chords (modifiers, scan_code, date, count)
+       VALUES (?, ?, ?, ?)
+       ON CONFLICT(modifiers, scan_code, date) DO UPDATE SET
+           count = count + excluded.count;)"};
+
+/// SQL query for inserting a finished typing session
+constexpr const char* INSERT_SESSION_SQL = {
+  R"(INSERT INTO sessions (date, start, end, key_count, peak_rate)
+       VALUES (?, ?, ?, ?, ?);)"};
+
+/// Compacts a partition and switches it out of WAL mode before it is made read-only
+constexpr const char* SEAL_PARTITION_SQL =
+  R"(PRAGMA wal_checkpoint(TRUNCATE);
+       PRAGMA journal_mode=DELETE;
+       VACUUM;)";
+
+/// Writes a compacted snapshot of the database into a new file
+constexpr const char* VACUUM_INTO_SQL = "VACUUM INTO ?;";
+
+/// Attaches a database partition under a schema name
+constexpr const char* ATTACH_PARTITION_SQL = "ATTACH DATABASE ? AS ?;";
+
+/// Detaches a database partition by its schema name
+constexpr const char* DETACH_PARTITION_SQL = "DETACH DATABASE ?;";
+
 /// SQL query to clear all entries from the keystrokes table
 constexpr const char* CLEAR_KEYSTROKES_TABLE_SQL = "DELETE FROM keystrokes;";
 
@@ -54,21 +157,89 @@ constexpr const char* GET_TOTAL_KEY_COUNTS_SQL = {
        GROUP BY scan_code
        ORDER BY scan_code ASC;)"};
 
-/// SQL query to get the daily amount of key presses over the last X days
+/// SQL query to get the daily amount of key presses between two dates (inclusive) over a
+/// set of attached partitions, the placeholder is replaced by the union of PARTITION_KEYSTROKES_SQL
 ///
 /// Example output:
 ///
 /// date        daily_total
 /// ----------  -----------
-/// 2025-09-20  28
-/// 2025-09-19  43
 /// 2025-09-18  58
-constexpr const char* GET_DAILY_COUNTS_SQL = {
+/// 2025-09-19  43
+/// 2025-09-20  28
+constexpr const char* GET_PARTITIONED_DAILY_COUNTS_SQL = {
   R"(SELECT date, SUM(count) AS daily_total
-       FROM keystrokes
-       WHERE date BETWEEN date('now', '-' || ? || ' days') AND date('now', 'localtime')
+       FROM ({})
+       GROUP BY date
+       ORDER BY date ASC;)"};
+
+/// SQL query selecting the keystrokes of the attached partition with the given number in a date range
+constexpr const char* PARTITION_KEYSTROKES_SQL = {
+  R"(SELECT date, count FROM partition_{}.keystrokes WHERE date BETWEEN ?1 AND ?2)"};
+
+/// SQL query to get the daily typing sessions between two dates (inclusive) over a set of attached
+/// partitions, the placeholder is replaced by the union of PARTITION_SESSIONS_SQL. The peak rate is in
+/// keys per minute.
+///
+/// Example output:
+///
+/// date        sessions  typing_seconds  key_count  peak_rate
+/// ----------  --------  --------------  ---------  ---------
+/// 2025-09-18  4         3902            8134       295
+/// 2025-09-19  1         845             1207       268
+/// 2025-09-20  3         2710            5321       312
+constexpr const char* GET_PARTITIONED_DAILY_SESSIONS_SQL = {
+  R"(SELECT date,
+              COUNT(*) AS sessions,
+              SUM(end - start) AS typing_seconds,
+              SUM(key_count) AS key_count,
+              MAX(peak_rate) AS peak_rate
+       FROM ({})
        GROUP BY date
-       ORDER BY date DESC;)"};
+       ORDER BY date ASC;)"};
+
+/// SQL query selecting the typing sessions of the attached partition with the given number in a date range
+constexpr const char* PARTITION_SESSIONS_SQL = {
+  R"(SELECT date, start, end, key_count, peak_rate FROM partition_{}.sessions WHERE date BETWEEN ?1 AND ?2)"};
+
+/// SQL query to get whether a table exists in the attached partition with the given number
+constexpr const char* PARTITION_HAS_TABLE_SQL = {
+  R"(SELECT 1 FROM partition_{}.sqlite_master WHERE type = 'table' AND name = ?;)"};
+
+/// SQL query to get the origin of the local keystroke counts
+constexpr const char* GET_ORIGIN_SQL = "SELECT value FROM metadata WHERE key = 'origin';";
+
+/// SQL query to get whether a table exists
+constexpr const char* HAS_TABLE_SQL = "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?;";
+
+/// SQL query to stream the local keystroke counts in merge order
+constexpr const char* GET_LOCAL_COUNTS_IN_MERGE_ORDER_SQL = {
+  R"(SELECT date, scan_code, key_name, count
+       FROM keystrokes
+       ORDER BY date ASC, scan_code ASC;)"};
+
+/// SQL query to stream the merged per-origin counts in merge order
+constexpr const char* GET_ORIGIN_COUNTS_IN_MERGE_ORDER_SQL = {
+  R"(SELECT date, scan_code, origin, key_name, count
+       FROM origin_counts
+       ORDER BY date ASC, scan_code ASC, origin ASC;)"};
+
+/// SQL query to fill the keystrokes table of a merged database with the combined totals, the sum
+/// of the highest count of every origin per (date, scan_code)
+///
+/// Example output (keystrokes):
+///
+/// scan_code  key_name  date        count
+/// ---------  --------  ----------  -----
+/// 30         KEY_A     2025-09-18  131
+/// 48         KEY_B     2025-09-18  27
+/// 30         KEY_A     2025-09-19  98
+constexpr const char* INSERT_MERGED_TOTALS_SQL = {
+  R"(INSERT INTO keystrokes (scan_code, key_name, date, count)
+       SELECT scan_code, MAX(key_name), date, SUM(count)
+       FROM origin_counts
+       GROUP BY date, scan_code
+       ORDER BY date ASC, scan_code ASC;)"};
 
 /// SQL query to get the top N most pressed keys in last X days
 ///
@@ -87,4 +258,22 @@ constexpr const char* GET_TOP_KEYS_SQL = {
        ORDER BY total_presses DESC
        LIMIT ?;)"};
 
+/// SQL query to get the top N most used modifier chords in last X days, modifiers is a bitmask of
+/// Shift (1), Ctrl (2), Alt (4), AltGr (8) and Super (16)
+///
+/// Example output:
+///
+/// modifiers  scan_code  total_presses
+/// ---------  ---------  -------------
+/// 2          46         64
+/// 2          47         51
+/// 4          15         23
+constexpr const char* GET_TOP_CHORDS_SQL = {
+  R"(SELECT modifiers, scan_code, SUM(count) AS total_presses
+       FROM chords
+       WHERE date >= date('now', 'localtime', '-' || ? || ' days')
+       GROUP BY modifiers, scan_code
+       ORDER BY total_presses DESC
+       LIMIT ?;)"};
+
 } // namespace typetrace::common
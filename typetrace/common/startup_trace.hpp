@@ -0,0 +1,88 @@
+#pragma once
+
+#include "clock.hpp"
+#include "logger.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace typetrace::common {
+
+/// Records how long each startup phase takes, phases may run on different threads
+class StartupTrace final
+{
+  public:
+    /// Creates a trace measuring the startup from the given point in time
+    explicit StartupTrace(Clock::time_point start = Clock::now()) : start_(start) {}
+
+    /// Runs the given function and records its duration under the given phase name
+    template<typename Func>
+    auto measure(std::string_view phase, Func&& func) -> decltype(std::forward<Func>(func)())
+    {
+        const auto begin = Clock::now();
+
+        if constexpr (std::is_void_v<decltype(std::forward<Func>(func)())>) {
+            std::forward<Func>(func)();
+            record(phase, begin);
+        } else {
+            auto result = std::forward<Func>(func)();
+            record(phase, begin);
+            return result;
+        }
+    }
+
+    /// Returns the point in time the startup is measured from
+    [[nodiscard]]
+    auto start() const -> Clock::time_point
+    {
+        return start_;
+    }
+
+    /// Logs the duration of every recorded phase and the total startup time
+    auto report() const -> void
+    {
+        using Milliseconds = std::chrono::duration<double, std::milli>;
+
+        auto& logger = Logger::instance();
+        const std::scoped_lock lock(mutex_);
+
+        for (const auto& phase : phases_) {
+            logger.info("Startup phase '{}' took {:.2f}ms (started at +{:.2f}ms)",
+                        phase.name,
+                        Milliseconds(phase.duration).count(),
+                        Milliseconds(phase.offset).count());
+        }
+
+        logger.info("Startup completed in {:.2f}ms", Milliseconds(Clock::now() - start_).count());
+    }
+
+    /// Stores a phase that started at the given time point and finished now, e.g. one ending in a callback
+    auto record(std::string_view phase, Clock::time_point begin) -> void
+    {
+        const auto end = Clock::now();
+        Logger::instance().debug("Startup phase '{}' finished", phase);
+
+        const std::scoped_lock lock(mutex_);
+        phases_.push_back({.name = phase, .offset = begin - start_, .duration = end - begin});
+    }
+
+  private:
+    /// A single measured startup phase
+    struct Phase
+    {
+        std::string_view name;
+        Clock::duration offset;
+        Clock::duration duration;
+    };
+
+    Clock::time_point start_;
+
+    mutable std::mutex mutex_;
+    std::vector<Phase> phases_;
+};
+
+} // namespace typetrace::common
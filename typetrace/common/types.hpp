@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <span>
 #include <string_view>
 
 namespace typetrace::common {
@@ -8,11 +11,70 @@ namespace typetrace::common {
 struct KeystrokeEvent
 {
     std::string_view key_name;
-    std::string_view date;
+    std::chrono::year_month_day date;
     std::uint32_t key_code;
     unsigned int count{0};
 };
 
-static_assert(sizeof(KeystrokeEvent) == 40);
+static_assert(sizeof(KeystrokeEvent) == 32);
+
+/// A typed character as null-terminated UTF-8
+using Character = std::array<char, 8>;
+
+struct CharacterEvent
+{
+    Character character;
+    std::chrono::year_month_day date;
+    unsigned int count{0};
+};
+
+static_assert(sizeof(CharacterEvent) == 16);
+
+/// Presses of a key while holding a combination of modifiers
+struct ChordEvent
+{
+    std::chrono::year_month_day date;
+    std::uint32_t key_code;
+    std::uint8_t modifiers; ///< Bitmask of the held modifiers
+    unsigned int count{0};
+};
+
+static_assert(sizeof(ChordEvent) == 16);
+
+/// A finished typing session, a run of key presses without an idle gap
+struct TypingSession
+{
+    std::chrono::sys_seconds start;
+    std::chrono::sys_seconds end;
+    std::chrono::year_month_day date; ///< Local date of the start
+    std::uint32_t key_count{0};
+    std::uint32_t peak_keys_per_minute{0};
+};
+
+/// Everything buffered since the last flush
+struct FlushBatch
+{
+    std::span<const KeystrokeEvent> keystrokes;
+    std::span<const CharacterEvent> characters;
+    std::span<const ChordEvent> chords;
+    std::span<const TypingSession> sessions;
+};
+
+/// Total amount of key presses on a single day
+struct DailyCount
+{
+    std::chrono::year_month_day date;
+    std::uint64_t total{0};
+};
+
+/// Typing sessions of a single day
+struct DailySessions
+{
+    std::chrono::year_month_day date;
+    std::uint32_t sessions{0};
+    std::uint64_t typing_seconds{0};
+    std::uint64_t key_count{0};
+    std::uint32_t peak_keys_per_minute{0};
+};
 
 } // namespace typetrace::common
@@ -1,9 +1,31 @@
-#include "application.hpp"
+#include "main_window.hpp"
+#include "startup_trace.hpp"
 
 #include <gtkmm/application.h>
 
 auto main(int argc, char* argv[]) -> int
 {
+    // Startup phases are measured from here until the first paint
+    typetrace::common::StartupTrace startup_trace;
+
     auto app = Gtk::Application::create("org.typetrace.frontend");
-    return app->make_window_and_run<typetrace::frontend::Application>(argc, argv);
+
+    app->signal_activate().connect([&app, &startup_trace] -> void {
+        if (auto* active = app->get_active_window(); active != nullptr) {
+            active->present();
+            return;
+        }
+
+        auto* window = startup_trace.measure("window construction", [&startup_trace] -> auto* {
+            return typetrace::frontend::MainWindow::create(startup_trace);
+        });
+        app->add_window(*window);
+
+        // Windows from Gtk::Builder are not managed, the window is deleted when it is closed
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+        window->signal_hide().connect([window] -> void { delete window; });
+        window->set_visible(true);
+    });
+
+    return app->run(argc, argv);
 }
@@ -0,0 +1,179 @@
+#ifndef TYPETRACE_FRONTEND_MAIN_WINDOW_HPP
+#define TYPETRACE_FRONTEND_MAIN_WINDOW_HPP
+
+#include "clock.hpp"
+#include "date.hpp"
+#include "logger.hpp"
+#include "model/summary.hpp"
+#include "service/backend_client.hpp"
+#include "service/summary_service.hpp"
+#include "startup_trace.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <gdkmm/frameclock.h>
+#include <glibmm/refptr.h>
+#include <glibmm/ustring.h>
+#include <gtkmm/applicationwindow.h>
+#include <gtkmm/box.h>
+#include <gtkmm/builder.h>
+#include <gtkmm/label.h>
+#include <gtkmm/stack.h>
+#include <memory>
+#include <sigc++/connection.h>
+#include <span>
+#include <string_view>
+
+namespace typetrace::frontend {
+
+/// The main window of the frontend
+///
+/// The window and its views are built from Blueprints compiled into an embedded GResource.
+/// Only the visible view is constructed at startup, the others on their first navigation.
+class MainWindow final : public Gtk::ApplicationWindow
+{
+  public:
+    /// Builds the main window, the caller owns the returned window
+    ///
+    /// The trace has to outlive the window, its startup phases are reported after the first paint.
+    [[nodiscard]]
+    static auto create(common::StartupTrace& startup_trace) -> MainWindow*
+    {
+        const auto builder = Gtk::Builder::create_from_resource(std::format("{}/ui/window.ui", RESOURCE_PREFIX));
+        return Gtk::Builder::get_widget_derived<MainWindow>(builder, "window", startup_trace);
+    }
+
+    /// Constructor used by Gtk::Builder - use create() instead
+    MainWindow(BaseObjectType* cobject, const Glib::RefPtr<Gtk::Builder>& builder, common::StartupTrace& startup_trace)
+      : Gtk::ApplicationWindow(cobject),
+        startup_trace_(startup_trace),
+        summary_label_(builder->get_widget<Gtk::Label>("summary_label")),
+        stack_(builder->get_widget<Gtk::Stack>("main_stack")),
+        summary_service_([this](const Summary& summary) -> void { show_summary(summary, false); })
+    {
+        // Render the last known summary right away, the database query replaces it later
+        if (const auto cached = startup_trace_.measure("summary cache", Summary::load_cached)) {
+            show_summary(*cached, true);
+        }
+
+        ensure_view(stack_->get_visible_child_name());
+        stack_->property_visible_child_name().signal_changed().connect(
+          [this] -> void { ensure_view(stack_->get_visible_child_name()); });
+
+        signal_realize().connect([this] -> void { measure_first_paint(); });
+
+        refresh_summary();
+
+        // Live updates keep the summary current while the backend is running
+        backend_ = startup_trace_.measure("backend connection", BackendClient::connect);
+        if (backend_) {
+            backend_->subscribe([this](const common::ipc::UpdateMessage&,
+                                       std::span<const common::ipc::KeyDelta> deltas) -> void { add_deltas(deltas); });
+        }
+    }
+
+  private:
+    /// Path prefix of the embedded UI resources
+    static constexpr std::string_view RESOURCE_PREFIX = "/org/typetrace/frontend";
+
+    /// Constructs the view of a stack page, unless it has been constructed before
+    auto ensure_view(const Glib::ustring& name) -> void
+    {
+        auto* page = dynamic_cast<Gtk::Box*>(stack_->get_child_by_name(name));
+        if (page == nullptr || page->get_first_child() != nullptr) {
+            return;
+        }
+
+        const auto started = Clock::now();
+
+        const auto builder =
+          Gtk::Builder::create_from_resource(std::format("{}/view/{}.ui", RESOURCE_PREFIX, name.raw()));
+        auto* view = builder->get_widget<Gtk::Widget>(std::format("{}_view", name.raw()));
+        if (view == nullptr) {
+            common::Logger::instance().warn("View resource of page '{}' has no '{}_view'", name.raw(), name.raw());
+            return;
+        }
+        page->append(*view);
+
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started);
+        common::Logger::instance().debug("Constructed {} view in {} us", name.raw(), elapsed.count());
+    }
+
+    /// Queries the summary again, key presses from now on are counted until it has finished
+    auto refresh_summary() -> void
+    {
+        if (summary_service_.refresh()) {
+            live_presses_ = 0;
+        }
+    }
+
+    /// Shows a summary in the header, summaries from the database replace the cache
+    ///
+    /// Key presses received while the database was queried are added on top of its totals, so they
+    /// are not lost when the result replaces the shown summary.
+    auto show_summary(const Summary& summary, bool from_cache) -> void
+    {
+        summary_ = summary;
+        summary_from_cache_ = from_cache;
+
+        if (!from_cache) {
+            summary_.today += live_presses_;
+            summary_.last_week += live_presses_;
+            summary_.save_cached();
+        }
+        summary_label_->set_text(summary_.text());
+    }
+
+    /// Adds the key presses of a live update to the shown summary
+    auto add_deltas(std::span<const common::ipc::KeyDelta> deltas) -> void
+    {
+        // After midnight today starts over, the week is queried again as its first day dropped out
+        if (const auto today = common::local_date(); summary_.date != today) {
+            summary_.date = today;
+            summary_.today = 0;
+            summary_.typing_seconds = 0;
+            summary_.session_keys = 0;
+            summary_.peak_keys_per_minute = 0;
+            refresh_summary();
+        }
+
+        std::uint64_t pressed = 0;
+        for (const auto& delta : deltas) {
+            pressed += delta.count;
+        }
+
+        live_presses_ += pressed;
+        summary_.today += pressed;
+        summary_.last_week += pressed;
+        summary_label_->set_text(summary_.text());
+    }
+
+    /// Records the time from launch until the first frame has been painted as a startup phase
+    auto measure_first_paint() -> void
+    {
+        first_paint_ = get_frame_clock()->signal_after_paint().connect([this] -> void {
+            first_paint_.disconnect();
+
+            startup_trace_.record(summary_from_cache_ ? "first paint (cached summary)" : "first paint",
+                                  startup_trace_.start());
+            startup_trace_.report();
+        });
+    }
+
+    common::StartupTrace& startup_trace_;
+    sigc::connection first_paint_;
+
+    Gtk::Label* summary_label_;
+    Gtk::Stack* stack_;
+    Summary summary_;
+    bool summary_from_cache_{false};
+    std::uint64_t live_presses_{0}; ///< Key presses received since the running summary query started
+
+    SummaryService summary_service_;
+    std::unique_ptr<BackendClient> backend_;
+};
+
+} // namespace typetrace::frontend
+
+#endif // TYPETRACE_FRONTEND_MAIN_WINDOW_HPP
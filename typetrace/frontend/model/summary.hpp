@@ -0,0 +1,116 @@
+#ifndef TYPETRACE_FRONTEND_MODEL_SUMMARY_HPP
+#define TYPETRACE_FRONTEND_MODEL_SUMMARY_HPP
+
+#include "constants.hpp"
+#include "date.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <system_error>
+
+namespace typetrace::frontend {
+
+/// Key press totals shown in the header of the main window
+///
+/// The last known summary is cached on disk, so the first frame can show it before the
+/// database has been queried. A cache written on another day is not shown.
+struct Summary
+{
+    std::chrono::year_month_day date;      ///< Local date the totals were counted on
+    std::uint64_t today{0};
+    std::uint64_t last_week{0};            ///< Including today
+    std::uint64_t typing_seconds{0};       ///< Time spent in the finished typing sessions of today
+    std::uint64_t session_keys{0};         ///< Key presses in the finished typing sessions of today
+    std::uint32_t peak_keys_per_minute{0};
+
+    /// Returns the text shown in the header
+    [[nodiscard]]
+    auto text() const -> std::string
+    {
+        auto text = std::format("{} key presses today, {} this week", today, last_week);
+        if (typing_seconds != 0) {
+            text += std::format(", {} WPM while typing, peak {} keys/min", words_per_minute(), peak_keys_per_minute);
+        }
+        return text;
+    }
+
+    /// Returns the average typing speed of today's sessions in words per minute
+    [[nodiscard]]
+    auto words_per_minute() const -> std::uint64_t
+    {
+        constexpr std::uint64_t SECONDS_PER_MINUTE = 60;
+        return typing_seconds == 0 ? 0 : session_keys * SECONDS_PER_MINUTE / (typing_seconds * KEYS_PER_WORD);
+    }
+
+    /// Loads the cached summary, if there is one of today
+    [[nodiscard]]
+    static auto load_cached() -> std::optional<Summary>
+    {
+        const auto file = cache_file();
+        if (!file) {
+            return std::nullopt;
+        }
+
+        std::string date_text;
+        Summary summary;
+        if (std::ifstream input(*file); !(input >> date_text >> summary.today >> summary.last_week
+                                          >> summary.typing_seconds >> summary.session_keys
+                                          >> summary.peak_keys_per_minute)) {
+            return std::nullopt;
+        }
+
+        // The totals of another day would show an old count as today's
+        const auto date = common::parse_date(date_text);
+        if (!date || *date != common::local_date()) {
+            return std::nullopt;
+        }
+        summary.date = *date;
+        return summary;
+    }
+
+    /// Replaces the cached summary, failures are ignored as the cache is only a startup aid
+    auto save_cached() const -> void
+    {
+        const auto file = cache_file();
+        if (!file) {
+            return;
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(file->parent_path(), error);
+
+        // Write a temporary file first, so a crash never leaves a truncated cache behind
+        auto temporary = *file;
+        temporary += ".tmp";
+        std::ofstream output(temporary);
+        if (!(output << common::format_date(date) << ' ' << today << ' ' << last_week << ' ' << typing_seconds << ' '
+                     << session_keys << ' ' << peak_keys_per_minute << '\n')) {
+            return;
+        }
+        output.close();
+        std::filesystem::rename(temporary, *file, error);
+    }
+
+    /// Returns the cache file in the XDG cache directory
+    [[nodiscard]]
+    static auto cache_file() -> std::optional<std::filesystem::path>
+    {
+        if (const char* cache_home = std::getenv("XDG_CACHE_HOME"); cache_home != nullptr && *cache_home != '\0') {
+            return std::filesystem::path(cache_home) / PROJECT_DIR_NAME / SUMMARY_CACHE_FILE_NAME;
+        }
+        if (const char* home = std::getenv("HOME"); home != nullptr) {
+            return std::filesystem::path(home) / ".cache" / PROJECT_DIR_NAME / SUMMARY_CACHE_FILE_NAME;
+        }
+        return std::nullopt;
+    }
+};
+
+} // namespace typetrace::frontend
+
+#endif // TYPETRACE_FRONTEND_MODEL_SUMMARY_HPP
@@ -0,0 +1,239 @@
+#ifndef TYPETRACE_FRONTEND_SERVICE_BACKEND_CLIENT_HPP
+#define TYPETRACE_FRONTEND_SERVICE_BACKEND_CLIENT_HPP
+
+#include "ipc.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <glibmm/iochannel.h>
+#include <glibmm/main.h>
+#include <memory>
+#include <sigc++/connection.h>
+#include <span>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace typetrace::frontend {
+
+/// Client of the backend IPC socket, driven by the GTK main loop
+///
+/// Requests are queued and written when the socket is writable, replies are dispatched to
+/// their handlers by request id. Neither sending nor receiving ever blocks the main loop.
+class BackendClient final
+{
+  public:
+    using MessageType = common::ipc::MessageType;
+    using ReplyHandler = std::function<void(MessageType, std::span<const std::byte>)>;
+    using UpdateHandler =
+      std::function<void(const common::ipc::UpdateMessage&, std::span<const common::ipc::KeyDelta>)>;
+
+    /// Connects to a running backend, returns nothing if no backend is listening
+    [[nodiscard]]
+    static auto connect() -> std::unique_ptr<BackendClient>
+    {
+        const auto socket_path = common::ipc::socket_path();
+        if (!socket_path) {
+            common::Logger::instance().debug("Backend socket has no private directory");
+            return nullptr;
+        }
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        const auto path = socket_path->string();
+        if (path.size() >= sizeof(address.sun_path)) {
+            return nullptr;
+        }
+        std::ranges::copy(path, std::begin(address.sun_path));
+
+        common::ipc::Socket socket(::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        if (!socket || ::connect(socket.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            common::Logger::instance().debug("Backend is not reachable on {}", path);
+            return nullptr;
+        }
+
+        // The watches capture the client, so it must not move
+        auto client = std::unique_ptr<BackendClient>(new BackendClient(std::move(socket)));
+        client->read_watch_ = Glib::signal_io().connect(
+          [client_ptr = client.get()](Glib::IOCondition condition) -> bool {
+              return client_ptr->on_readable(condition);
+          },
+          client->socket_.get(),
+          Glib::IOCondition::IO_IN | Glib::IOCondition::IO_HUP | Glib::IOCondition::IO_ERR);
+        return client;
+    }
+
+    BackendClient(const BackendClient&) = delete;
+    auto operator=(const BackendClient&) -> BackendClient& = delete;
+    BackendClient(BackendClient&&) = delete;
+    auto operator=(BackendClient&&) -> BackendClient& = delete;
+
+    ~BackendClient()
+    {
+        read_watch_.disconnect();
+        write_watch_.disconnect();
+    }
+
+    /// Queues a request, the handler is called with its reply
+    auto request(MessageType type, ReplyHandler on_reply, std::span<const std::byte> payload = {}) -> std::uint32_t
+    {
+        const auto id = next_request_id_++;
+        common::ipc::append_frame(output_, type, id, payload);
+        if (on_reply) {
+            pending_[id] = std::move(on_reply);
+        }
+
+        send();
+        return id;
+    }
+
+    /// Subscribes to the live updates of the backend
+    auto subscribe(UpdateHandler on_update) -> void
+    {
+        const auto id = request(MessageType::SUBSCRIBE, {});
+        subscriptions_[id] = std::move(on_update);
+    }
+
+    /// Returns whether the connection to the backend is still open
+    [[nodiscard]]
+    auto connected() const -> bool
+    {
+        return static_cast<bool>(socket_);
+    }
+
+  private:
+    explicit BackendClient(common::ipc::Socket socket) : socket_(std::move(socket)) {}
+
+    /// Reads the available replies and dispatches them
+    auto on_readable(Glib::IOCondition condition) -> bool
+    {
+        std::array<std::byte, 4096> chunk{};
+        while (true) {
+            const auto received = ::recv(socket_.get(), chunk.data(), chunk.size(), MSG_DONTWAIT);
+            if (received > 0) {
+                input_.insert(input_.end(), chunk.begin(), chunk.begin() + received);
+                continue;
+            }
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                condition |= Glib::IOCondition::IO_HUP;
+            }
+            break;
+        }
+
+        std::size_t consumed = 0;
+        while (true) {
+            const auto frame = common::ipc::next_frame(std::span(input_).subspan(consumed));
+            if (frame.status != common::ipc::FrameStatus::COMPLETE) {
+                break;
+            }
+            dispatch(frame.header, frame.payload);
+            consumed += frame.size;
+        }
+        input_.erase(input_.begin(), input_.begin() + static_cast<std::ptrdiff_t>(consumed));
+
+        if ((condition & (Glib::IOCondition::IO_HUP | Glib::IOCondition::IO_ERR)) != Glib::IOCondition{}) {
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    /// Passes a message to the handler of its request or subscription
+    auto dispatch(const common::ipc::FrameHeader& header, std::span<const std::byte> payload) -> void
+    {
+        if (header.type == MessageType::UPDATE) {
+            const auto handler = subscriptions_.find(header.request_id);
+            const auto update = common::ipc::read_payload<common::ipc::UpdateMessage>(payload);
+            if (handler == subscriptions_.end() || !update) {
+                return;
+            }
+
+            deltas_.clear();
+            for (std::uint32_t i = 0; i < update->delta_count; ++i) {
+                const auto delta = common::ipc::read_payload<common::ipc::KeyDelta>(
+                  payload, sizeof(common::ipc::UpdateMessage) + (i * sizeof(common::ipc::KeyDelta)));
+                if (!delta) {
+                    return;
+                }
+                deltas_.push_back(*delta);
+            }
+            handler->second(*update, deltas_);
+            return;
+        }
+
+        if (const auto handler = pending_.extract(header.request_id)) {
+            handler.mapped()(header.type, payload);
+        }
+    }
+
+    /// Writes as much of the queued requests as the socket takes, waits for writability otherwise
+    auto send() -> void
+    {
+        if (!socket_) {
+            return;
+        }
+
+        while (!output_.empty()) {
+            const auto sent = ::send(socket_.get(), output_.data(), output_.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    disconnect();
+                }
+                break;
+            }
+            output_.erase(output_.begin(), output_.begin() + sent);
+        }
+
+        if (!output_.empty() && !write_watch_.connected()) {
+            write_watch_ = Glib::signal_io().connect(
+              [this](Glib::IOCondition) -> bool {
+                  send();
+                  return !output_.empty() && connected();
+              },
+              socket_.get(),
+              Glib::IOCondition::IO_OUT);
+        }
+    }
+
+    /// Closes the connection, pending requests are dropped
+    auto disconnect() -> void
+    {
+        common::Logger::instance().info("Disconnected from the backend");
+        read_watch_.disconnect();
+        write_watch_.disconnect();
+        socket_.reset();
+        pending_.clear();
+        subscriptions_.clear();
+        output_.clear();
+    }
+
+    common::ipc::Socket socket_;
+    std::vector<std::byte> input_;
+    std::vector<std::byte> output_;
+    std::uint32_t next_request_id_{1};
+
+    std::unordered_map<std::uint32_t, ReplyHandler> pending_;
+    std::unordered_map<std::uint32_t, UpdateHandler> subscriptions_;
+    std::vector<common::ipc::KeyDelta> deltas_;
+
+    sigc::connection read_watch_;
+    sigc::connection write_watch_;
+};
+
+} // namespace typetrace::frontend
+
+#endif // TYPETRACE_FRONTEND_SERVICE_BACKEND_CLIENT_HPP
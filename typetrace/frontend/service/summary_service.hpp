@@ -0,0 +1,119 @@
+#ifndef TYPETRACE_FRONTEND_SERVICE_SUMMARY_SERVICE_HPP
+#define TYPETRACE_FRONTEND_SERVICE_SUMMARY_SERVICE_HPP
+
+#include "date.hpp"
+#include "logger.hpp"
+#include "model/summary.hpp"
+#include "partition_reader.hpp"
+#include "partitions.hpp"
+
+#include <functional>
+#include <glibmm/dispatcher.h>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+namespace typetrace::frontend {
+
+/// Queries the summary from the database partitions off the main thread
+///
+/// The result is handed back to the GTK main loop through a dispatcher, so the callback can
+/// update widgets directly.
+class SummaryService final
+{
+  public:
+    using Callback = std::function<void(const Summary&)>;
+
+    explicit SummaryService(Callback on_loaded) : on_loaded_(std::move(on_loaded))
+    {
+        dispatcher_.connect([this] -> void { deliver(); });
+    }
+
+    /// Starts a query in the background, returns false if one is still running
+    auto refresh() -> bool
+    {
+        if (worker_.joinable()) {
+            return false;
+        }
+
+        worker_ = std::jthread([this] -> void {
+            const auto summary = query();
+            {
+                const std::scoped_lock lock(mutex_);
+                result_ = summary;
+            }
+            dispatcher_.emit();
+        });
+        return true;
+    }
+
+  private:
+    /// Number of days counted in the weekly total, including today
+    static constexpr int SUMMARY_DAYS = 7;
+
+    /// Passes the finished query to the callback, runs on the main loop
+    auto deliver() -> void
+    {
+        worker_.join();
+
+        std::optional<Summary> summary;
+        {
+            const std::scoped_lock lock(mutex_);
+            summary = std::exchange(result_, std::nullopt);
+        }
+
+        if (summary) {
+            on_loaded_(*summary);
+        }
+    }
+
+    /// Sums the daily counts of the last days and reads the typing sessions of today
+    [[nodiscard]]
+    static auto query() -> std::optional<Summary>
+    {
+        const auto db_dir = common::database_dir();
+        if (!db_dir) {
+            return std::nullopt;
+        }
+
+        const auto today = common::local_date();
+        const auto first_day = common::from_day_number(common::to_day_number(today) - (SUMMARY_DAYS - 1));
+
+        const auto counts = common::PartitionReader::daily_counts(*db_dir, first_day, today);
+        const auto sessions = common::PartitionReader::daily_sessions(*db_dir, today, today);
+        if (!counts || !sessions) {
+            common::Logger::instance().warn("Failed to query the summary: {}",
+                                            (counts ? sessions.error() : counts.error()).message);
+            return std::nullopt;
+        }
+
+        Summary summary;
+        summary.date = today;
+        for (const auto& count : *counts) {
+            summary.last_week += count.total;
+            if (count.date == today) {
+                summary.today += count.total;
+            }
+        }
+        for (const auto& day : *sessions) {
+            summary.typing_seconds = day.typing_seconds;
+            summary.session_keys = day.key_count;
+            summary.peak_keys_per_minute = day.peak_keys_per_minute;
+        }
+
+        return summary;
+    }
+
+    Callback on_loaded_;
+    Glib::Dispatcher dispatcher_;
+
+    std::mutex mutex_;
+    std::optional<Summary> result_;
+
+    std::jthread worker_; ///< Declared last, so it is joined before the members it uses are destroyed
+};
+
+} // namespace typetrace::frontend
+
+#endif // TYPETRACE_FRONTEND_SERVICE_SUMMARY_SERVICE_HPP